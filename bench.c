@@ -0,0 +1,507 @@
+/*
+ * bench.c - micro-benchmarks for the hot paths of root-tail
+ *
+ * This includes root-tail.c directly, with the X calls it makes
+ * replaced by counting stubs, so that lineinput (),
+ * possibly_split_long_line () and refresh () can be timed without a
+ * display.  The stub font is a fixed 6 pixels per single-byte
+ * character and 12 pixels per multibyte character; the splits are timed
+ * both as if it were proportional and as a fixed width font.
+ *
+ * Every benchmark prints the time and the number of allocations
+ * (xmalloc/xrealloc/xstrdup/malloc) per line, and the number of X
+ * requests per line where that makes sense.
+ *
+ *   make bench && ./root-tail-bench [scale]
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ */
+
+#include "config.h"
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <langinfo.h>
+#include <locale.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static unsigned long bench_allocs;
+static unsigned long bench_xrequests;
+
+static void *bench_malloc(size_t size)
+{
+    bench_allocs++;
+    return malloc(size);
+}
+
+static void *bench_realloc(void *ptr, size_t size)
+{
+    bench_allocs++;
+    return realloc(ptr, size);
+}
+
+static char *bench_strdup(const char *s)
+{
+    bench_allocs++;
+    return strdup(s);
+}
+
+#define STUB_CHAR_WIDTH 6
+
+static int bench_XmbTextEscapement(XFontSet fs, const char *s, int n)
+{
+    int w = 0;
+
+    bench_xrequests++; /* not a request, but a library call we count */
+    while (n > 0) {
+        int len = mblen(s, n);
+
+        if (len <= 0)
+            len = 1;
+        w += len == 1 ? STUB_CHAR_WIDTH : 2 * STUB_CHAR_WIDTH;
+        s += len;
+        n -= len;
+    }
+
+    return w;
+}
+
+static Status bench_XmbTextPerCharExtents(XFontSet fs, const char *s, int n,
+                                          XRectangle *ink, XRectangle *logical,
+                                          int size, int *count,
+                                          XRectangle *overall_ink,
+                                          XRectangle *overall_logical)
+{
+    int i = 0, x = 0;
+
+    bench_xrequests++; /* not a request, but a library call we count */
+    while (n > 0) {
+        int len = mblen(s, n);
+
+        if (len <= 0)
+            len = 1;
+        if (i < size) {
+            logical[i].x = x;
+            logical[i].width
+                = len == 1 ? STUB_CHAR_WIDTH : 2 * STUB_CHAR_WIDTH;
+            x += logical[i].width;
+        }
+        i++;
+        s += len;
+        n -= len;
+    }
+
+    *count = i;
+    return i <= size;
+}
+
+static void bench_XmbDrawString(Display *d, Drawable w, XFontSet fs, GC gc,
+                                int x, int y, const char *s, int n)
+{
+    bench_xrequests++;
+}
+
+static void bench_XmbDrawText(Display *d, Drawable w, GC gc, int x, int y,
+                              XmbTextItem *items, int n)
+{
+    bench_xrequests++;
+}
+
+static int bench_XClearArea(Display *d, Window w, int x, int y,
+                            unsigned int width, unsigned int height, Bool e)
+{
+    bench_xrequests++;
+    return 1;
+}
+
+static int bench_XCopyArea(Display *d, Drawable src, Drawable dest, GC gc,
+                           int src_x, int src_y, unsigned int width,
+                           unsigned int height, int dest_x, int dest_y)
+{
+    bench_xrequests++;
+    return 1;
+}
+
+static int bench_XSetForeground(Display *d, GC gc, unsigned long pixel)
+{
+    bench_xrequests++;
+    return 1;
+}
+
+static int bench_XSetClipMask(Display *d, GC gc, Pixmap mask)
+{
+    bench_xrequests++;
+    return 1;
+}
+
+static int bench_XDrawRectangle(Display *d, Drawable w, GC gc, int x, int y,
+                                unsigned int width, unsigned int height)
+{
+    bench_xrequests++;
+    return 1;
+}
+
+#ifdef DEBUG
+static int bench_XFillRectangle(Display *d, Drawable w, GC gc, int x, int y,
+                                unsigned int width, unsigned int height)
+{
+    bench_xrequests++;
+    return 1;
+}
+#endif
+
+static Status bench_XGetWindowAttributes(Display *d, Window w,
+                                         XWindowAttributes *attr)
+{
+    bench_xrequests++;
+    memset(attr, 0, sizeof *attr);
+    return 1;
+}
+
+static Status bench_XParseColor(Display *d, Colormap c, const char *spec,
+                                XColor *color)
+{
+    color->pixel = 0;
+    return 1;
+}
+
+static Status bench_XAllocColor(Display *d, Colormap c, XColor *color)
+{
+    bench_xrequests++;
+    return 1;
+}
+
+#define malloc bench_malloc
+#define realloc bench_realloc
+#define strdup bench_strdup
+#define XmbTextEscapement bench_XmbTextEscapement
+#define XmbTextPerCharExtents bench_XmbTextPerCharExtents
+#define XmbDrawString bench_XmbDrawString
+#define XmbDrawText bench_XmbDrawText
+#define XClearArea bench_XClearArea
+#define XCopyArea bench_XCopyArea
+#define XSetForeground bench_XSetForeground
+#define XSetClipMask bench_XSetClipMask
+#define XDrawRectangle bench_XDrawRectangle
+#ifdef DEBUG
+#define XFillRectangle bench_XFillRectangle
+#endif
+#define XGetWindowAttributes bench_XGetWindowAttributes
+#define XParseColor bench_XParseColor
+#define XAllocColor bench_XAllocColor
+#define main root_tail_main
+
+#include "root-tail.c"
+
+#undef main
+#undef malloc
+#undef realloc
+#undef strdup
+
+static struct logfile_entry bench_log;
+static long scale = 1;
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void report(const char *name, double ns, unsigned long allocs,
+                   unsigned long xreqs, long lines)
+{
+    printf("%-44s %10.1f ns/line %8.2f allocs/line %8.2f X calls/line\n", name,
+           ns / lines, (double)allocs / lines, (double)xreqs / lines);
+}
+
+/* a line of roughly LEN bytes of words, using multibyte characters if UTF8 */
+static char *make_text(int len, int utf8)
+{
+    static const char *ascii_words[]
+        = {"kernel:", "eth0", "link", "up,", "100Mbps,", "full-duplex"};
+    static const char *utf8_words[]
+        = {"Größe", "überschritten:", "ошибка", "диска", "été", "naïve"};
+    const char **words = utf8 ? utf8_words : ascii_words;
+    char *s = xmalloc(len + 32);
+    int n = 0, i = 0;
+
+    s[0] = 0;
+    while (n < len) {
+        const char *w = words[i++ % 6];
+
+        strcpy(s + n, w);
+        n += strlen(w);
+        s[n++] = ' ';
+        s[n] = 0;
+    }
+
+    s[len] = 0;
+    return s;
+}
+
+/* free every screen line after the first KEEP, as refresh () would */
+static void trim_lines(int keep)
+{
+    struct line_node *line = linelist;
+
+    while (line && keep--)
+        line = line->next;
+
+    if (!line)
+        return;
+
+    line->prev->next = 0;
+
+    while (line) {
+        struct line_node *this = line;
+        line = line->next;
+        if (this->logfile && this->logfile->last == this)
+            this->logfile->last = NULL;
+        free(this->line);
+        free(this->breaks);
+        free(this->words);
+        free(this);
+    }
+}
+
+static void bench_lineinput(int line_len)
+{
+    long lines = 20000 * scale, i;
+    char *text = make_text(line_len, 0);
+    size_t size = (line_len + 1) * lines;
+    char *data = xmalloc(size), *p = data;
+    unsigned long allocs;
+    double t;
+    char name[64];
+
+    for (i = 0; i < lines; i++) {
+        memcpy(p, text, line_len);
+        p[line_len] = '\n';
+        p += line_len + 1;
+    }
+
+    bench_log.fp = fmemopen(data, size, "r");
+    bench_log.buf = 0;
+
+    allocs = bench_allocs;
+    t = now();
+    for (i = 0; lineinput(&bench_log); i++) {
+        free(bench_log.buf);
+        bench_log.buf = 0;
+    }
+    t = now() - t;
+
+    assert(i == lines);
+    sprintf(name, "lineinput %d bytes", line_len);
+    report(name, t, bench_allocs - allocs, 0, lines);
+
+    fclose(bench_log.fp);
+    free(data);
+    free(text);
+}
+
+static void bench_split(const char *mode, int wordwrap, int justify, int utf8,
+                        int fixed)
+{
+    long lines = 20000 * scale, i;
+    char *text = make_text(300, utf8);
+    unsigned long allocs = 0, xreqs;
+    double t = 0, t0;
+    char name[64];
+
+    opt_wordwrap = wordwrap;
+    opt_justify = justify;
+    continuation_width = -1;
+    bench_log.last = NULL;
+    bench_log.char_width = fixed ? fixed_width(bench_log.fontset) : 0;
+
+    xreqs = bench_xrequests;
+    for (i = 0; i < lines; i++) {
+        unsigned long a = bench_allocs;
+
+        t0 = now();
+        insert_new_line(xstrdup(text), &bench_log, 0);
+        t += now() - t0;
+        allocs += bench_allocs - a;
+
+        if ((i & 255) == 255)
+            trim_lines(listlen);
+    }
+
+    sprintf(name, "split 300 bytes %s %s%s", utf8 ? "utf8" : "ascii", mode,
+            fixed ? " fixed" : "");
+    report(name, t, allocs, bench_xrequests - xreqs, lines);
+
+    trim_lines(listlen);
+    free(text);
+}
+
+/* a progress line growing one byte at a time, as seen with -update */
+static void bench_append(void)
+{
+    long appends = 20000 * scale, i;
+    unsigned long allocs, xreqs;
+    double t;
+
+    opt_wordwrap = opt_justify = 0;
+    continuation_width = -1;
+    bench_log.last = NULL;
+    insert_new_line(xstrdup("building"), &bench_log, 0);
+
+    allocs = bench_allocs;
+    xreqs = bench_xrequests;
+    t = now();
+    for (i = 0; i < appends; i++)
+        append_to_existing_line(xstrdup("."), &bench_log);
+    t = now() - t;
+
+    report("append 1 byte to a partial line", t, bench_allocs - allocs,
+           bench_xrequests - xreqs, appends);
+
+    trim_lines(listlen);
+}
+
+static void bench_refresh(const char *mode, int noflicker, int outline,
+                          int shade, int justify)
+{
+    long refreshes = 2000 * scale, i;
+    char *text = make_text(justify ? 300 : 60, 0);
+    unsigned long allocs = 0, xreqs = 0;
+    double t = 0, t0;
+    char name[64];
+
+    opt_noflicker = noflicker;
+    opt_outline = outline;
+    opt_shade = shade;
+    opt_wordwrap = opt_justify = justify;
+    continuation_width = -1;
+    select_draw_rows();
+
+    for (i = 0; i < refreshes; i++) {
+        unsigned long a, x;
+
+        /* a new line arrives, then the screen is brought up to date */
+        bench_log.last = NULL;
+        insert_new_line(xstrdup(text), &bench_log, 0);
+
+        a = bench_allocs;
+        x = bench_xrequests;
+        t0 = now();
+        redraw(0);
+        t += now() - t0;
+        allocs += bench_allocs - a;
+        xreqs += bench_xrequests - x;
+    }
+
+    sprintf(name, "refresh %s (per screen line)", mode);
+    report(name, t, allocs, xreqs, refreshes * (height / 13));
+
+    free(text);
+}
+
+/* writing -state, whose lines must read back exactly as they were */
+static void bench_state(void)
+{
+    long saves = 200 * scale, i;
+    char *text = make_text(60, 0), *fname = bench_log.fname;
+    unsigned long allocs;
+    double t;
+
+    opt_wordwrap = opt_justify = 0;
+    continuation_width = -1;
+    state_file = "/tmp/root-tail-bench.state";
+
+    /* a file name and a line starting with spaces, which must be kept */
+    bench_log.fname = "  bench";
+    for (i = 0; i < listlen; i++) {
+        bench_log.last = NULL;
+        insert_new_line(xstrdup(i < listlen - 1 ? text : "    indented"),
+                        &bench_log, 0);
+    }
+
+    allocs = bench_allocs;
+    t = now();
+    for (i = 0; i < saves; i++)
+        save_state();
+    t = now() - t;
+
+    report("save -state (per screen line)", t, bench_allocs - allocs, 0,
+           saves * listlen);
+
+    load_state();
+    assert(saved_files_count == 1 && !strcmp(saved_files[0].name, "  bench"));
+    assert(saved_lines_count == listlen);
+    assert(!strcmp(saved_lines[saved_lines_count - 1].text, "    indented"));
+    restore_lines();
+
+    unlink(state_file);
+    state_file = NULL;
+    bench_log.fname = fname;
+    trim_lines(listlen);
+    free(text);
+}
+
+int main(int argc, char **argv)
+{
+    int i;
+
+    if (argc > 1)
+        scale = atol(argv[1]);
+    if (scale < 1)
+        scale = 1;
+
+    if (!setlocale(LC_CTYPE, "C.UTF-8") && !setlocale(LC_CTYPE, "en_US.UTF-8"))
+        fprintf(stderr, "no UTF-8 locale, multibyte text will be measured "
+                        "byte by byte\n");
+    utf8_locale = !strcmp(nl_langinfo(CODESET), "UTF-8");
+
+    bench_log.fname = "bench";
+    bench_log.desc = "bench";
+    bench_log.font_height = 13;
+    bench_log.font_ascent = 10;
+    bench_log.colorname = def_color;
+    bench_log.poll_index = -1;
+    loglist = &bench_log;
+
+    init_linelist();
+
+    bench_lineinput(16);
+    bench_lineinput(80);
+    bench_lineinput(200);
+    bench_lineinput(2000);
+
+    for (i = 0; i < 2; i++) {
+        bench_split("plain", 0, 0, 0, i);
+        bench_split("wordwrap", 1, 0, 0, i);
+        bench_split("justify", 1, 1, 0, i);
+        bench_split("plain", 0, 0, 1, i);
+        bench_split("wordwrap", 1, 0, 1, i);
+        bench_split("justify", 1, 1, 1, i);
+    }
+    bench_log.char_width = 0;
+
+    bench_append();
+    bench_state();
+
+    bench_refresh("plain", 0, 0, 0, 0);
+    bench_refresh("noflicker", 1, 0, 0, 0);
+    bench_refresh("outline", 0, 1, 0, 0);
+    bench_refresh("shade", 0, 0, 1, 0);
+    bench_refresh("noflicker outline", 1, 1, 0, 0);
+    bench_refresh("justify", 0, 0, 0, 1);
+
+    /* erasing from a -bgcache pixmap instead of with XClearArea () */
+    bg_pixmap = 1;
+    bench_refresh("bgcache", 0, 0, 0, 0);
+    bench_refresh("noflicker bgcache", 1, 0, 0, 0);
+    bg_pixmap = None;
+
+    return 0;
+}
@@ -13,5 +13,56 @@
 #define LOC_X           30
 #define LOC_Y           30
 
+//how much to read from one file before looking at the others and the
+//X server.. -batch changes the number of lines at runtime
+#define DEF_BATCH_LINES 100
+#define BATCH_BYTES     65536
+#define PASS_MS         20
+
+//lines are cut short after this many bytes (-maxline), and after this
+//many screen rows when wrapped (-maxrows); 0 for no limit.  where they
+//were cut, TRUNCATE_MARK is shown
+#define DEF_MAX_LINE    0
+#define DEF_MAX_ROWS    0
+#define TRUNCATE_MARK   "..."
+
+//how many -syslog messages to receive at once, and how long they can be
+#define SYSLOG_BATCH    16
+#define SYSLOG_MSG_SIZE 8192
+
+//how often (in seconds) -state is written, if anything changed
+#define STATE_INTERVAL  10
+
+//files that can't be watched are polled this often (in ms) while they're
+//being written to, backing off to -interval when they're not
+#define POLL_MIN_MS     100
+
 #define VERSION "1.2"
 
+/* use epoll, signalfd, timerfd and inotify in the main loop, rather
+ * than select () and polling alone */
+#ifdef __linux__
+#define HAS_EPOLL 1
+#endif
+
+/* receive a batch of -syslog messages per system call */
+#ifdef __linux__
+#define _GNU_SOURCE 1
+#define HAS_RECVMMSG 1
+#endif
+
+/* accept stats socket clients non-blocking in a single call */
+#ifdef __linux__
+#define HAS_ACCEPT4 1
+#endif
+
+/* look for non-ASCII text 16 bytes at a time */
+#ifdef __SSE2__
+#define HAS_SSE2 1
+#endif
+
+/* -ring, lines written to shared memory by producers using rtring.h */
+#ifdef __linux__
+#define HAS_RING 1
+#endif
+
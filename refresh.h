@@ -0,0 +1,129 @@
+/*
+ * refresh.h - the loop over the screen lines in refresh (), compiled
+ * once for every combination of -noflicker, -outline or -shade, and
+ * -reverse, so that it doesn't have to look at those options for every
+ * line.  root-tail.c includes this once per variant, with DRAW_ROWS
+ * (the name), NOFLICKER, EFFECT (EFFECT_NONE, EFFECT_OUTLINE or
+ * EFFECT_SHADE) and REVERSE defined.
+ *
+ * DRAW_ROWS () draws the lines that fit, between MINY and MAXY, and
+ * returns the first line that didn't fit.  *OFFSET_P and *SPACE_P are
+ * updated to where it got to and how much room is left.
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ */
+
+static struct line_node *DRAW_ROWS(int miny, int maxy, int clear,
+                                   int refresh_all, int *offset_p,
+                                   int *space_p)
+{
+    struct line_node *line;
+    int lin = 0;
+    int offset = *offset_p, space = *space_p;
+    int step_per_line;
+#if EFFECT != EFFECT_NONE
+    unsigned long black_color = GetColor("black");
+#endif
+
+    for (line = linelist; line; line = line->next, lin++) {
+#if NOFLICKER
+        struct displaymatrix *display_line;
+
+        if (lin >= listlen) {
+            int i = listlen;
+            listlen *= 1.5;
+            display = xrealloc(display, listlen * sizeof(struct displaymatrix));
+            memset(display + i, 0, (listlen - i) * sizeof(struct displaymatrix));
+        }
+
+        display_line = display + lin;
+#endif
+
+        step_per_line = line->logfile->font_height + effect_y_space;
+        if (step_per_line > space)
+            break;
+
+#if !REVERSE
+        offset -= step_per_line;
+#endif
+
+        offset += line->logfile->font_ascent;
+
+        miny -= line->logfile->font_height;
+        maxy += line->logfile->font_height;
+
+        /* with -noflicker, only if this line is a different than it
+         * was does it need displaying */
+        if (offset >= miny && offset <= maxy
+#if NOFLICKER
+            && (refresh_all || display_line->hash != line->hash
+                || display_line->color != line->logfile->color
+                || display_line->offset != offset)
+#endif
+        ) {
+#if NOFLICKER
+            display_line->hash = line->hash;
+            display_line->color = line->logfile->color;
+            display_line->offset = offset;
+
+            if (clear) {
+#ifdef DEBUG
+                static int toggle;
+                toggle = 1 - toggle;
+                XSetForeground(disp, WinGC,
+                               toggle ? GetColor("cyan") : GetColor("yellow"));
+                XFillRectangle(disp, root, WinGC, win_x,
+                               win_y + offset - line->logfile->font_ascent,
+                               width, step_per_line);
+#else  /* DEBUG */
+                clear_area(win_x, win_y + offset - line->logfile->font_ascent,
+                           width + MARGIN_OF_ERROR, step_per_line);
+#endif /* DEBUG */
+            }
+#endif /* NOFLICKER */
+
+#if EFFECT == EFFECT_OUTLINE
+            {
+                int x, y;
+                XSetForeground(disp, WinGC, black_color);
+
+                for (x = -1; x <= 1; x += 2)
+                    for (y = -1; y <= 1; y += 2)
+                        draw_text(disp, root, WinGC,
+                                  win_x + effect_x_offset + x,
+                                  win_y + y + offset, line, 0);
+            }
+#elif EFFECT == EFFECT_SHADE
+            XSetForeground(disp, WinGC, black_color);
+            draw_text(disp, root, WinGC, win_x + effect_x_offset + SHADE_X,
+                      win_y + offset + SHADE_Y, line, 0);
+#endif
+
+            XSetForeground(disp, WinGC, line->logfile->color);
+            draw_text(disp, root, WinGC, win_x + effect_x_offset,
+                      win_y + offset, line, 1);
+        }
+
+#if REVERSE
+        offset += step_per_line;
+#endif
+        offset -= line->logfile->font_ascent;
+
+        miny += line->logfile->font_height;
+        maxy -= line->logfile->font_height;
+
+        space -= step_per_line;
+    }
+
+    *offset_p = offset;
+    *space_p = space;
+    return line;
+}
+
+#undef DRAW_ROWS
+#undef NOFLICKER
+#undef EFFECT
+#undef REVERSE
@@ -30,15 +30,25 @@
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <fnmatch.h>
+#include <glob.h>
+#include <langinfo.h>
+#include <limits.h>
 #include <locale.h>
+#include <netinet/in.h>
 #include <signal.h>
+#include <spawn.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/un.h>
+#include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -46,6 +56,28 @@
 #include <regex.h>
 #endif
 
+#if HAS_RING
+#include "rtring.h"
+#endif
+
+#if HAS_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifdef USE_XCB
+#include <X11/Xlib-xcb.h>
+#include <xcb/xcb.h>
+#endif
+
+#if HAS_EPOLL
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <sys/vfs.h>
+#endif
+
 #define SHADE_X 2
 #define SHADE_Y 2
 
@@ -53,19 +85,40 @@
  * the mess */
 #define MARGIN_OF_ERROR 2
 
+/* how much of the start of a file is checksummed to tell whether it is
+ * still the same file when it's reopened */
+#define FINGERPRINT_SIZE 256
+
 /* data structures */
 struct logfile_entry {
     struct logfile_entry *next;
+    struct logfile_entry *prev;
 
     char *fname; /* name of file                                 */
     char *desc;  /* alternative description                      */
+    char *header;     /* "[desc]", shown when switching to this file */
+    int header_len;   /* its length in bytes                         */
+    int header_width; /* its width in pixels, -1 if not measured yet */
     char *buf;   /* text read but not yet displayed              */
+    int buf_len;  /* its length, while lineinput () builds it     */
+    int buf_size; /* and the space allocated for it               */
+    int line_len;  /* bytes kept of the line being read, for -maxline */
+    int truncated; /* true if the rest of that line is thrown away    */
+    int rows;      /* screen rows the last line shown takes up        */
+    int rows_cut;  /* true if it was cut short by -maxrows            */
     const char *fontname;
     XFontSet fontset;
     int font_height;
     int font_ascent;
+    int char_width;  /* the width of every printable ASCII character if
+                        the font is fixed width, else 0 */
     FILE *fp;               /* FILE struct associated with file             */
     ino_t inode;            /* inode of the file opened                     */
+    dev_t dev;              /* and the device it is on                      */
+    off_t offset;           /* how far we had read when it was closed       */
+    unsigned int fingerprint; /* checksum of its first bytes                */
+    int fingerprint_len;    /* how many bytes that is                       */
+    unsigned long pending_bytes; /* bytes of buf not displayed yet          */
     off_t last_size;        /* file size at the last check                  */
     unsigned long color;    /* color to be used for printing                */
     const char *colorname;  /* color name/string                            */
@@ -73,6 +126,94 @@ struct logfile_entry {
     int lastpartial;        /* true if the previous output wasn't complete  */
     struct line_node *last; /* last line we output                          */
     int modified;           /* true if line is modified & needs displaying  */
+    unsigned long bytes_read; /* statistics: bytes read from the file       */
+    unsigned long lines_read; /* statistics: complete lines read            */
+    int ready;              /* true if on the ready queue                   */
+    unsigned long throttled; /* statistics: times the batch limit was hit   */
+    int recheck;            /* true if on the recheck queue                 */
+    struct logfile_entry *ready_next;   /* next file with data to read      */
+    struct logfile_entry *recheck_next; /* next file to look for rotation   */
+    struct logfile_entry *hash_next;    /* next file in the same hash chain */
+    long long poll_at;      /* when to poll the file next, if not watched   */
+    long long poll_ms;      /* the time between the last two polls          */
+    int poll_index;         /* index in poll_heap, -1 if not in it          */
+    struct glob_source *glob; /* the pattern it matched, NULL if named      */
+    int state_index;        /* its number in the last -state file, or -1    */
+    struct syslog_batch *syslog; /* for -syslog sources, instead of fp      */
+#if HAS_RING
+    struct rt_ring *ring;   /* for -ring sources, instead of fp             */
+#endif
+#if HAS_EPOLL
+    int wd;                 /* inotify watch descriptor, -1 if none         */
+    struct event_source *source; /* epoll registration for pipes          */
+#if HAS_RING
+    struct event_source *listen_source; /* -ring: producers attaching     */
+#endif
+#endif
+};
+
+/* messages received on a -syslog socket, handed out one at a time as
+ * the lines of the source; each buffer becomes the text of a line */
+struct syslog_batch {
+    int fd;
+    char *path;                         /* the unix socket, NULL for udp   */
+    int count;                          /* messages received               */
+    int next;                           /* the next one to hand out        */
+    char *bufs[SYSLOG_BATCH];
+    struct iovec iovs[SYSLOG_BATCH];
+#if HAS_RECVMMSG
+    struct mmsghdr hdrs[SYSLOG_BATCH];
+#else
+    int lens[SYSLOG_BATCH];
+    int truncated[SYSLOG_BATCH];
+#endif
+};
+
+/* a pattern (or directory) whose matching files are tailed, picking
+ * up new matches as they appear */
+struct glob_source {
+    struct glob_source *next;
+    char *pattern;
+    int rescan;                 /* true if there may be new matches       */
+    struct logfile_entry proto; /* font, color and desc for the matches   */
+};
+
+#if HAS_EPOLL
+/* what an inotify watch descriptor refers to */
+struct watch {
+    struct logfile_entry *log; /* a file, or                             */
+    struct glob_source *glob;  /* a directory that may get new matches   */
+    char *dir;                 /* and its name, as glob () spells it     */
+};
+
+/* what an epoll event refers to */
+enum event_type {
+    EV_X,
+    EV_SIGNAL,
+    EV_TIMER,
+    EV_INOTIFY,
+    EV_STATS,
+    EV_STATS_CLIENT,
+    EV_FILE
+};
+
+struct event_source {
+    enum event_type type;
+    int fd;
+    struct logfile_entry *log;     /* for EV_FILE         */
+    struct stats_client *client;   /* for EV_STATS_CLIENT */
+};
+#endif
+
+/* a stats client that hasn't been sent all of its dump yet */
+struct stats_client {
+    struct stats_client *next;
+    int fd;
+    char *buf;
+    size_t len, done;
+#if HAS_EPOLL
+    struct event_source source;
+#endif
 };
 
 struct line_node {
@@ -85,26 +226,73 @@ struct line_node {
     int wrapped_left;         /* true if wrapped from the previous line       */
     int wrapped_right;        /* true if wrapped to the next line             */
     struct breakinfo *breaks; /* array of indicies to spaces if wrapped_right */
-    int num_words;            /* the number of words in the line              */
-    int free_pixels;          /* the number of free pixels to spread out      */
+    int breaks_size;          /* allocated size of 'breaks'                   */
+    XmbTextItem *words;       /* with -justify, the words to draw, spread out */
+    int num_words;            /* the number of them                           */
+
+    /* how far possibly_split_long_line () got in measuring the line */
+    int measured;    /* bytes measured so far                              */
+    int width;       /* their width in pixels, including any continuation  */
+    int spaces;      /* number of places the line could be broken at       */
+    int break_index; /* index of the last of them, -1 if none              */
+    int break_width; /* width in pixels of the line up to there            */
+
+    unsigned long long hash; /* of the row's text, see hash_row ()         */
 };
 
 struct breakinfo {
     int index; /* index into string of start of substring       */
-    int width; /* width in pixels of start of substring         */
     int len;   /* length of substring                           */
 };
 
+/* histogram buckets: bucket i counts latencies below 2^i milliseconds */
+#define LATENCY_BUCKETS 16
+
+struct statistics {
+    time_t started;
+    long long start_ms;           /* when we started, on mono_ms ()'s clock */
+    long long first_frame_ms;     /* how long until the first refresh ()    */
+    unsigned long redraws;        /* calls to refresh ()                    */
+    unsigned long lines_dropped;  /* lines scrolled off the screen          */
+    unsigned long escapements;    /* calls to XmbText*Extents/Escapement () */
+    unsigned long allocations;    /* calls to xmalloc/xrealloc/xstrdup      */
+    unsigned long pending_lines;  /* lines read but not yet drawn           */
+    struct timeval pending_since; /* when the oldest of those was read      */
+    unsigned long latency[LATENCY_BUCKETS + 1]; /* ingest to draw           */
+};
+
+#ifdef TRACE
+/* trace probes: every probe becomes one complete ("X") event in a
+ * ring buffer, which is written out in chrome trace-event format
+ * (chrome://tracing, perfetto) on SIGUSR1.  without -DTRACE the
+ * probes compile to nothing. */
+#define TRACE_EVENTS 65536
+#define TRACE_DEPTH 16
+
+struct trace_event {
+    const char *name;
+    double start; /* microseconds */
+    double duration;
+};
+
+#define TRACE_BEGIN(name) trace_begin(name)
+#define TRACE_END() trace_end()
+#else
+#define TRACE_BEGIN(name)
+#define TRACE_END()
+#endif
+
+/* what -noflicker last drew on a row of the screen; 0 if nothing */
 struct displaymatrix {
-    char *line;
-    int len;
+    unsigned long long hash;
     int offset;
-    int buffer_size;
     unsigned long color;
 };
 
 /* global variables */
 struct line_node *linelist = NULL, *linelist_tail = NULL;
+/* the file that the last line shown came from */
+struct logfile_entry *lastprinted;
 struct displaymatrix *display;
 int continuation_width = -1;
 int continuation_color;
@@ -113,28 +301,90 @@ int continuation_length;
 /* HACK - ideally listlen will start at however many '~'s will fit on
  * the screen */
 int width = STD_WIDTH, height = STD_HEIGHT, listlen = 50;
+int batch_lines = DEF_BATCH_LINES;
+int max_line = DEF_MAX_LINE, max_rows = DEF_MAX_ROWS;
+int truncate_width; /* the width of TRUNCATE_MARK in pixels */
+int utf8_locale;    /* true if text is UTF-8, which we decode ourselves */
+/* the widths of the characters possibly_split_long_line () looks at */
+XRectangle *char_ink, *char_extents;
+int char_extents_size;
 int win_x = LOC_X, win_y = LOC_Y;
 int effect_x_space,
     effect_y_space; /* how much space does shading / outlining take up */
 int effect_x_offset,
     effect_y_offset; /* and how does it offset the usable space */
 int do_reopen;
+int do_dump_stats;
+int do_refresh;
+int do_quit;
+int do_reap;
+pid_t reload_pid; /* the -reload command while it runs, else 0 */
+long long next_poll, next_reload; /* deadlines, in ms of CLOCK_MONOTONIC */
+/* the files without a watch, as a min-heap on poll_at */
+struct logfile_entry **poll_heap;
+int poll_heap_len, poll_heap_size;
+#if HAS_EPOLL
+int epoll_fd = -1, inotify_fd = -1, signal_fd = -1, timer_fd = -1;
+long long timer_deadline; /* what timer_fd is set to, 0 once it went off */
+struct watch *watches; /* indexed by watch descriptor */
+int watches_size;
+#endif
+struct statistics stats;
+int stats_fd = -1;
+struct stats_client *stats_clients;
+long long next_state; /* when to write -state next */
+unsigned long state_redraws; /* stats.redraws when it was last written */
+
+#ifdef TRACE
+struct trace_event trace_ring[TRACE_EVENTS];
+unsigned long trace_count;
+struct trace_event trace_stack[TRACE_DEPTH];
+int trace_depth;
+const char *trace_file = "root-tail-trace.json";
+#endif
 struct timeval interval = {2, 400000};
 
 /* command line options */
 int opt_noinitial, opt_shade, opt_frame, opt_reverse, opt_nofilename,
     opt_outline, opt_noflicker, opt_whole, opt_update, opt_wordwrap,
-    opt_justify, geom_mask, opt_minspace, reload;
+    opt_justify, geom_mask, opt_minspace, opt_bgcache, reload;
 const char *command = NULL, *fontname = USE_FONT, *dispname = NULL,
            *def_color = DEF_COLOR, *continuation = "|| ",
-           *cont_color = DEF_CONT_COLOR;
+           *cont_color = DEF_CONT_COLOR, *stats_socket = NULL,
+           *state_file = NULL;
 
 struct logfile_entry *loglist = NULL, *loglist_tail = NULL;
+struct glob_source *globlist = NULL, *globlist_tail = NULL;
+
+/* files by name, to find out whether a match is new */
+#define FILE_HASH_SIZE 4096
+struct logfile_entry *file_hash[FILE_HASH_SIZE];
+
+/* files which need reading, and files which need checking for rotation */
+struct logfile_entry *ready_head, *ready_tail;
+struct logfile_entry *recheck_head, *recheck_tail;
 
 Display *disp;
 Window root;
 GC WinGC;
 
+/* the top level window root was found through (the __SWM_VROOT or
+ * nautilus desktop window), or None if we draw on the real root */
+Window root_parent;
+int track_root; /* false with -id: the window is never looked for again */
+int do_find_root;
+Atom swm_vroot_atom, nautilus_atom, rootpmap_atom;
+
+/* the top level windows that cover the whole screen, as virtual roots
+ * do; their size is known from CreateNotify and ConfigureNotify */
+Window *screen_windows;
+int num_screen_windows, screen_windows_size;
+
+/* -bgcache: what is under the text area, and the GC to copy it with */
+Pixmap bg_pixmap;
+GC bg_gc;
+int do_capture_background;
+
 #if HAS_REGEX
 struct re_list {
     regex_t from;
@@ -148,8 +398,14 @@ regex_t *transformre;
 
 /* prototypes */
 void list_files(int);
+void force_dump_stats(int);
+void dump_stats(FILE *);
+void open_stats_socket(void);
+void serve_stats(void);
 void force_reopen(int);
 void force_refresh(int);
+void force_quit(int);
+void child_exited(int);
 void blank_window(int);
 #ifdef USE_TOON_GET_ROOT_WINDOW
 Window ToonGetRootWindow(Display *, int, Window *);
@@ -163,9 +419,17 @@ void refresh(int, int, int, int);
 void transform_line(char *s);
 int lineinput(struct logfile_entry *);
 void reopen(void);
-void check_open_files(void);
+int check_open_file(struct logfile_entry *);
+int check_open_files(void);
+void mark_ready(struct logfile_entry *);
+void mark_recheck(struct logfile_entry *);
+void scan_glob(struct glob_source *, int);
+static void saved_position(struct logfile_entry *);
+static void display_buf(struct logfile_entry *);
 FILE *openlog(struct logfile_entry *);
 static void main_loop(void);
+static long long mono_ms(void);
+static void clear_area(int, int, int, int);
 
 void display_version(void);
 void display_help(char *);
@@ -175,6 +439,28 @@ void *xmalloc(size_t);
 void *xrealloc(void *, size_t);
 int daemonize(void);
 
+/*
+ * split a "name[,color[,desc]]" argument in place.  this is not
+ * foolproof yet (',' in filenames are not allowed)
+ */
+static void split_spec(char *arg, const char **color, const char **desc)
+{
+    char *p;
+
+    *color = def_color;
+    *desc = arg;
+
+    if ((p = strchr(arg, ','))) {
+        *p = '\0';
+        *color = p + 1;
+
+        if ((p = strchr(*color, ','))) {
+            *p = '\0';
+            *desc = p + 1;
+        }
+    }
+}
+
 /* signal handlers */
 void list_files(int dummy)
 {
@@ -185,349 +471,1098 @@ void list_files(int dummy)
         fprintf(stderr, "\t%s (%s)\n", e->fname, e->desc);
 }
 
+void force_dump_stats(int dummy) { do_dump_stats = 1; }
+
 void force_reopen(int dummy) { do_reopen = 1; }
 
-void force_refresh(int dummy) { redraw(1); }
+void force_refresh(int dummy) { do_refresh = 1; }
+
+void force_quit(int dummy) { do_quit = 1; }
+
+void child_exited(int dummy) { do_reap = 1; }
+
+/* the -syslog sockets and the -ring files are ours to remove */
+static void unlink_sockets(void)
+{
+    struct logfile_entry *e;
+
+    for (e = loglist; e; e = e->next) {
+        if (e->syslog && e->syslog->path)
+            unlink(e->syslog->path);
+#if HAS_RING
+        if (e->ring)
+            rt_ring_unlink(e->ring);
+#endif
+    }
+}
 
 void blank_window(int dummy)
 {
-    XClearArea(disp, root, win_x, win_y, width + MARGIN_OF_ERROR, height,
-               False);
+    unlink_sockets();
+
+    clear_area(win_x, win_y, width + MARGIN_OF_ERROR, height);
     XFlush(disp);
     exit(0);
 }
 
-/* X related functions */
-unsigned long GetColor(const char *ColorName)
+/* statistics */
+
+/* note that a line has been read and is waiting to be drawn */
+static void stats_line_read(void)
 {
-    XColor Color;
-    XWindowAttributes Attributes;
+    if (!stats.pending_lines++)
+        gettimeofday(&stats.pending_since, NULL);
+}
 
-    XGetWindowAttributes(disp, root, &Attributes);
-    Color.pixel = 0;
+/* note that everything read so far is now on the screen */
+static void stats_lines_drawn(void)
+{
+    struct timeval now;
+    long ms;
+    int bucket = 0;
 
-    if (!XParseColor(disp, Attributes.colormap, ColorName, &Color))
-        fprintf(stderr, "can't parse %s\n", ColorName);
-    else if (!XAllocColor(disp, Attributes.colormap, &Color))
-        fprintf(stderr, "can't allocate %s\n", ColorName);
+    if (!stats.pending_lines)
+        return;
 
-    return Color.pixel;
+    gettimeofday(&now, NULL);
+    ms = (now.tv_sec - stats.pending_since.tv_sec) * 1000
+         + (now.tv_usec - stats.pending_since.tv_usec) / 1000;
+
+    while (bucket < LATENCY_BUCKETS && ms >= 1L << bucket)
+        bucket++;
+
+    stats.latency[bucket] += stats.pending_lines;
+    stats.pending_lines = 0;
 }
 
-#ifndef USE_TOON_GET_ROOT_WINDOW
-static void find_root_window(Display *display, int screen_number)
+/* how many bytes are waiting to be read from a file */
+static long file_backlog(struct logfile_entry *e)
 {
-    if (!root) {
-        Atom SWM_VROOT = XInternAtom(display, "__SWM_VROOT", False);
-        Atom NAUTILUS_DESKTOP_WINDOW_ID
-            = XInternAtom(display, "NAUTILUS_DESKTOP_WINDOW_ID", False);
+    struct stat st;
+    int pending;
 
-        Window unused, *windows = 0;
-        unsigned int count;
+    if (e->syslog) /* only the size of the next message */
+        return ioctl(e->syslog->fd, FIONREAD, &pending) < 0 ? 0 : pending;
 
-        Atom type;
-        int format;
-        unsigned long nitems, bytes_after_return;
-        unsigned char *virtual_root_window;
+    if (!e->fp)
+        return 0;
 
-        root = RootWindow(display, screen_number);
+    if (!e->inode)
+        return ioctl(fileno(e->fp), FIONREAD, &pending) < 0 ? 0 : pending;
 
-        if (XGetWindowProperty(display, root, NAUTILUS_DESKTOP_WINDOW_ID, 0, 1,
-                               False, XA_WINDOW, &type, &format, &nitems,
-                               &bytes_after_return, &virtual_root_window)
-                == Success
-            && type == XA_WINDOW) {
-            if (XQueryTree(display, *(Window *)virtual_root_window, &unused,
-                           &unused, &windows, &count))
-                root = windows[count - 1];
+    if (fstat(fileno(e->fp), &st) < 0 || st.st_size < ftell(e->fp))
+        return 0;
 
-            XFree(virtual_root_window);
-        } else if (XQueryTree(display, root, &unused, &unused, &windows,
-                              &count)) {
-            int i;
+    return st.st_size - ftell(e->fp);
+}
 
-            for (i = 0; i < count; i++) {
-                if (XGetWindowProperty(display, windows[i], SWM_VROOT, 0, 1,
-                                       False, XA_WINDOW, &type, &format,
-                                       &nitems, &bytes_after_return,
-                                       &virtual_root_window)
-                        == Success
-                    && type == XA_WINDOW) {
-                    root = *(Window *)virtual_root_window;
-                    XFree(virtual_root_window);
-                    break;
-                }
-            }
+/* the statistics are written one "name value" pair per line, so
+ * that they are easy to scrape */
+void dump_stats(FILE *f)
+{
+    struct logfile_entry *e;
+    int i;
 
-            XFree(windows);
-        } else
-            fprintf(stderr, "Can't query tree on root window 0x%lx", root);
+    fprintf(f, "uptime_seconds %ld\n", (long)(time(NULL) - stats.started));
+    fprintf(f, "time_to_first_frame_ms %lld\n", stats.first_frame_ms);
+    fprintf(f, "redraws %lu\n", stats.redraws);
+    fprintf(f, "lines_dropped %lu\n", stats.lines_dropped);
+    fprintf(f, "x_requests %lu\n", disp ? XNextRequest(disp) - 1 : 0);
+    fprintf(f, "text_escapements %lu\n", stats.escapements);
+    fprintf(f, "allocations %lu\n", stats.allocations);
+
+    for (i = 0; i < LATENCY_BUCKETS; i++)
+        fprintf(f, "latency_ms_below{le=\"%ld\"} %lu\n", 1L << i,
+                stats.latency[i]);
+    fprintf(f, "latency_ms_below{le=\"inf\"} %lu\n",
+            stats.latency[LATENCY_BUCKETS]);
+
+    for (e = loglist; e; e = e->next) {
+        const char *name = e->fname ? e->fname : "-";
+
+        fprintf(f, "file_bytes_read{file=\"%s\"} %lu\n", name, e->bytes_read);
+        fprintf(f, "file_lines_read{file=\"%s\"} %lu\n", name, e->lines_read);
+        fprintf(f, "file_throttled{file=\"%s\"} %lu\n", name, e->throttled);
+        if (e->poll_index >= 0)
+            fprintf(f, "file_poll_interval_ms{file=\"%s\"} %lld\n", name,
+                    e->poll_ms);
+        fprintf(f, "file_backlog_bytes{file=\"%s\"} %ld\n", name,
+                file_backlog(e));
+#if HAS_RING
+        if (e->ring)
+            fprintf(f, "file_dropped{file=\"%s\"} %lu\n", name,
+                    e->ring->shared->dropped);
+#endif
     }
 }
-#endif /* USE_TOON_GET_ROOT_WINDOW */
 
-void InitWindow(void)
+void open_stats_socket(void)
 {
-    XGCValues gcv;
-    unsigned long gcm;
-    int screen, ScreenWidth, ScreenHeight;
-    struct logfile_entry *e;
+    struct sockaddr_un addr;
 
-    if (!(disp = XOpenDisplay(dispname))) {
-        fprintf(stderr, "Can't open display %s.\n", dispname);
+    if (strlen(stats_socket) >= sizeof addr.sun_path) {
+        fprintf(stderr, "stats socket name '%s' is too long\n", stats_socket);
         exit(1);
     }
 
-    screen = DefaultScreen(disp);
-    ScreenHeight = DisplayHeight(disp, screen);
-    ScreenWidth = DisplayWidth(disp, screen);
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, stats_socket);
 
-    find_root_window(disp, screen);
+    /* a stale socket from an earlier run would make bind () fail */
+    unlink(stats_socket);
 
-    gcm = GCBackground;
-    gcv.graphics_exposures = True;
-    WinGC = XCreateGC(disp, root, gcm, &gcv);
-    XMapWindow(disp, root);
+    if ((stats_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0
+        || bind(stats_fd, (struct sockaddr *)&addr, sizeof addr) < 0
+        || listen(stats_fd, 4) < 0
+        || fcntl(stats_fd, F_SETFL, O_NONBLOCK) < 0)
+        perror(stats_socket), exit(1);
 
-    XSetForeground(disp, WinGC, GetColor(DEF_COLOR));
+    /* a client going away early must not kill us */
+    install_signal(SIGPIPE, SIG_IGN);
+}
 
-    for (e = loglist; e; e = e->next) {
-        char **missing_charset_list;
-        int missing_charset_count;
-        char *def_string;
+/* the next client waiting on the stats socket, never blocking on it */
+static int accept_stats_client(void)
+{
+#if HAS_ACCEPT4
+    return accept4(stats_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+    int fd = accept(stats_fd, NULL, NULL);
 
-        e->fontset = XCreateFontSet(disp, e->fontname, &missing_charset_list,
-                                    &missing_charset_count, &def_string);
+    if (fd >= 0 && fcntl(fd, F_SETFL, O_NONBLOCK) < 0) {
+        close(fd);
+        return -1;
+    }
 
-        if (missing_charset_count) {
-            fprintf(stderr,
-                    "Missing charsets in String to FontSet conversion (%s)\n",
-                    missing_charset_list[0]);
-            XFreeStringList(missing_charset_list);
+    return fd;
+#endif
+}
+
+/*
+ * send a stats client what its socket takes of the rest of its dump.
+ * returns true once it is done with: all of it was sent, or the client
+ * went away.
+ */
+static int write_stats_client(struct stats_client *c)
+{
+    ssize_t n = 0;
+
+    while (c->done < c->len
+           && (n = write(c->fd, c->buf + c->done, c->len - c->done)) > 0)
+        c->done += n;
+
+    return c->done == c->len || (n < 0 && errno != EAGAIN && errno != EINTR);
+}
+
+static void free_stats_client(struct stats_client *c)
+{
+    struct stats_client **p;
+
+    for (p = &stats_clients; *p; p = &(*p)->next)
+        if (*p == c) {
+            *p = c->next;
+            break;
         }
 
-        if (!e->fontset) {
-            fprintf(stderr,
-                    "unable to create fontset for font '%s', exiting.\n",
-                    e->fontname);
-            exit(1);
+    close(c->fd); /* which takes it out of the epoll set too */
+    free(c->buf);
+    free(c);
+}
+
+/*
+ * answer every client waiting on the stats socket with a dump.  what
+ * doesn't fit in the socket buffer is kept, and sent as the client
+ * reads: one that doesn't read must not stall the main loop.
+ */
+void serve_stats(void)
+{
+    int fd;
+
+    if (stats_fd < 0)
+        return;
+
+    while ((fd = accept_stats_client()) >= 0) {
+        struct stats_client *c = xmalloc(sizeof(struct stats_client));
+        FILE *f;
+
+        memset(c, 0, sizeof *c);
+        c->fd = fd;
+        c->next = stats_clients;
+        stats_clients = c;
+
+        if (!(f = open_memstream(&c->buf, &c->len))) {
+            free_stats_client(c);
+            continue;
+        }
+        dump_stats(f);
+        fclose(f);
+
+        if (write_stats_client(c)) {
+            free_stats_client(c);
+            continue;
         }
 
+#if HAS_EPOLL
         {
-            XFontSetExtents *xfe = XExtentsOfFontSet(e->fontset);
+            struct epoll_event ev;
 
-            e->font_height = xfe->max_logical_extent.height;
-            e->font_ascent = -xfe->max_logical_extent.y;
-        }
+            c->source.type = EV_STATS_CLIENT;
+            c->source.fd = fd;
+            c->source.client = c;
+            ev.events = EPOLLOUT;
+            ev.data.ptr = &c->source;
 
-        if (e->font_height > height - effect_y_space) {
-            fprintf(stderr,
-                    "\n  the display isn't tall enough to display a single "
-                    "line in font '%s'\n",
-                    e->fontname);
-            fprintf(stderr, "\n  the geometry in use is %d pixels tall\n",
-                    height);
-            fprintf(stderr, "\n  font '%s' is %d pixels tall\n", e->fontname,
-                    e->font_height);
-            if (effect_y_space)
-                fprintf(stderr,
-                        "\n  the shade or outline options need an extra %d "
-                        "pixel%s of vertical space\n",
-                        effect_y_space, effect_y_space == 1 ? "" : "s");
-            fprintf(stderr, "\n");
-            exit(1);
+            if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
+                free_stats_client(c);
         }
+#endif
     }
+}
 
-    if (geom_mask & XNegative)
-        win_x = win_x + ScreenWidth - width;
-    if (geom_mask & YNegative)
-        win_y = win_y + ScreenHeight - height;
+#ifdef TRACE
+static double trace_now(void)
+{
+    struct timespec ts;
 
-    {
-        struct logfile_entry *e;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
 
-        for (e = loglist; e; e = e->next)
-            e->color = GetColor(e->colorname);
+static void trace_begin(const char *name)
+{
+    if (trace_depth < TRACE_DEPTH) {
+        trace_stack[trace_depth].name = name;
+        trace_stack[trace_depth].start = trace_now();
     }
 
-    XSelectInput(disp, root, ExposureMask | FocusChangeMask);
+    trace_depth++;
 }
 
-/*
- * if redraw () is passwd a non-zero argument, it does a complete
- * redraw, rather than an update.  if the argument is zero (and
- * -noflicker is in effect) then only the lines which have changed
- * since the last draw are redrawn.
- *
- * the rest is handled by regular refresh ()'es
- */
-void redraw(int redraw_all)
+static void trace_end(void)
 {
-    XSetClipMask(disp, WinGC, None);
-    refresh(0, 32768, 1, redraw_all);
+    struct trace_event *ev;
+
+    assert(trace_depth > 0);
+
+    if (--trace_depth >= TRACE_DEPTH)
+        return;
+
+    ev = trace_ring + trace_count++ % TRACE_EVENTS;
+    *ev = trace_stack[trace_depth];
+    ev->duration = trace_now() - ev->start;
 }
 
-void draw_text(Display *disp, Window root, GC WinGC, int x, int y,
-               struct line_node *line, int foreground)
+/* write the contents of the ring buffer, oldest event first */
+static void trace_dump(void)
 {
-    if (line->wrapped_right && opt_justify && line->breaks) {
-        int i;
-        for (i = 0; i < line->num_words; i++)
-            XmbDrawString(
-                disp, root, line->logfile->fontset, WinGC,
-                x + line->breaks[i].width
-                    + ((i * line->free_pixels) / (line->num_words - 1))
-                    + continuation_width * line->wrapped_left,
-                y, line->line + line->breaks[i].index, line->breaks[i].len);
+    FILE *f = fopen(trace_file, "w");
+    unsigned long i = 0;
+    int pid = getpid();
+    const char *sep = "";
+
+    if (!f) {
+        perror(trace_file);
+        return;
+    }
 
-        if (line->wrapped_left) {
-            if (foreground)
-                XSetForeground(disp, WinGC, continuation_color);
-            XmbDrawString(disp, root, line->logfile->fontset, WinGC, x, y,
-                          continuation, continuation_length);
-        }
-    } else {
-        XmbDrawString(disp, root, line->logfile->fontset, WinGC,
-                      x + continuation_width * line->wrapped_left, y,
-                      line->line, line->len);
+    if (trace_count > TRACE_EVENTS)
+        i = trace_count - TRACE_EVENTS;
 
-        if (line->wrapped_left) {
-            if (foreground)
-                XSetForeground(disp, WinGC, continuation_color);
-            XmbDrawString(disp, root, line->logfile->fontset, WinGC, x, y,
-                          continuation, continuation_length);
-        }
+    fprintf(f, "{\"traceEvents\":[");
+    for (; i < trace_count; i++) {
+        struct trace_event *ev = trace_ring + i % TRACE_EVENTS;
+
+        fprintf(f,
+                "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,"
+                "\"dur\":%.3f,\"pid\":%d,\"tid\":%d}",
+                sep, ev->name, ev->start, ev->duration, pid, pid);
+        sep = ",";
     }
+    fprintf(f, "\n]}\n");
+
+    fclose(f);
 }
+#endif /* TRACE */
 
-/* Just redraw everything without clearing (i.e. after an EXPOSE event) */
-void refresh(int miny, int maxy, int clear, int refresh_all)
-{
-    int lin = 0;
-    int space = height;
-    int offset;
-    unsigned long black_color = GetColor("black");
-    struct line_node *line;
-    int step_per_line;
-    int foreground = 0;
+/* X related functions */
 
-    if (opt_reverse)
-        offset = effect_y_offset;
-    else
-        offset = height + effect_y_offset;
+/* every color GetColor () was asked for, and its pixel */
+struct color_entry {
+    char *name;
+    unsigned long pixel;
+    int allocated; /* true if XAllocColor () gave us the pixel */
+    struct color_entry *next;
+};
 
-    miny -= win_y;
-    maxy -= win_y;
+static struct color_entry *color_cache;
 
-    if (clear && !opt_noflicker)
-        XClearArea(disp, root, win_x, win_y, width + MARGIN_OF_ERROR, height,
-                   False);
-
-    for (line = linelist; line; line = line->next, lin++) {
-        struct displaymatrix *display_line;
-
-        if (opt_noflicker && lin >= listlen) {
-            int i = listlen;
-            listlen *= 1.5;
-            display = xrealloc(display, listlen * sizeof(struct displaymatrix));
-            for (; i < listlen; i++) {
-                display[i].line = xstrdup("");
-                display[i].len = 0;
-                display[i].offset = 0;
-                display[i].buffer_size = 0;
-            }
-        }
+/* root's colormap and, on a TrueColor visual, where each of red, green
+ * and blue goes in a pixel */
+static int colors_ready;
+static Colormap colormap;
+static int true_color;
+static int channel_shift[3], channel_bits[3];
 
-        display_line = display + lin;
+static void init_colors(void)
+{
+    XWindowAttributes Attributes;
+    int i;
 
-        step_per_line = line->logfile->font_height + effect_y_space;
-        if (step_per_line > space)
-            break;
+    XGetWindowAttributes(disp, root, &Attributes);
+    colormap = Attributes.colormap;
+    colors_ready = 1;
+
+    if (!Attributes.visual || Attributes.visual->class != TrueColor)
+        return;
+
+    true_color = 1;
+    for (i = 0; i < 3; i++) {
+        unsigned long mask = i == 0 ? Attributes.visual->red_mask
+                           : i == 1 ? Attributes.visual->green_mask
+                                    : Attributes.visual->blue_mask;
+
+        channel_shift[i] = channel_bits[i] = 0;
+        if (!mask)
+            continue;
+
+        while (!(mask >> channel_shift[i] & 1))
+            channel_shift[i]++;
+        while (mask >> (channel_shift[i] + channel_bits[i]) & 1)
+            channel_bits[i]++;
+        if (channel_bits[i] > 16)
+            channel_bits[i] = 16;
+    }
+}
 
-        if (!opt_reverse)
-            offset -= step_per_line;
-
-        offset += line->logfile->font_ascent;
-
-        miny -= line->logfile->font_height;
-        maxy += line->logfile->font_height;
-
-        if (offset >= miny && offset <= maxy) {
-            /* if this line is a different than it was, then it
-             * needs displaying */
-            if (!opt_noflicker || refresh_all || display_line->len != line->len
-                || display_line->color != line->logfile->color
-                || display_line->offset != offset
-                || memcmp(display_line->line, line->line, line->len)) {
-                /* don't bother updating the record of what has been
-                 * displayed if -noflicker isn't in effect, since we redraw
-                 * the whole display every time anyway */
-                if (opt_noflicker) {
-                    /* update the record of what has been displayed;
-                     * first make sure the buffer is big enough */
-                    if (display_line->buffer_size < line->len) {
-                        display_line->buffer_size = line->len;
-                        display_line->line = xrealloc(
-                            display_line->line, display_line->buffer_size);
-                    }
+/* the pixel for COLOR on a TrueColor visual, without asking the server */
+static unsigned long true_color_pixel(const XColor *color)
+{
+    unsigned long value[3];
+    unsigned long pixel = 0;
+    int i;
 
-                    display_line->len = line->len;
-                    display_line->color = line->logfile->color;
-                    display_line->offset = offset;
-                    memcpy(display_line->line, line->line, line->len);
+    value[0] = color->red;
+    value[1] = color->green;
+    value[2] = color->blue;
 
-                    if (clear) {
-#ifdef DEBUG
-                        static int toggle;
-                        toggle = 1 - toggle;
-                        XSetForeground(disp, WinGC,
-                                       toggle ? GetColor("cyan")
-                                              : GetColor("yellow"));
-                        XFillRectangle(disp, root, WinGC, win_x,
-                                       win_y + offset
-                                           - line->logfile->font_ascent,
-                                       width, step_per_line);
-#else  /* DEBUG */
-                        XClearArea(disp, root, win_x,
-                                   win_y + offset - line->logfile->font_ascent,
-                                   width + MARGIN_OF_ERROR, step_per_line,
-                                   False);
-#endif /* DEBUG */
-                    }
-                }
+    for (i = 0; i < 3; i++)
+        if (channel_bits[i])
+            pixel |= value[i] >> (16 - channel_bits[i]) << channel_shift[i];
 
-                if (opt_outline) {
-                    int x, y;
-                    XSetForeground(disp, WinGC, black_color);
-
-                    for (x = -1; x <= 1; x += 2)
-                        for (y = -1; y <= 1; y += 2)
-                            draw_text(disp, root, WinGC,
-                                      win_x + effect_x_offset + x,
-                                      win_y + y + offset, line, foreground = 0);
-                } else if (opt_shade) {
-                    XSetForeground(disp, WinGC, black_color);
-                    draw_text(disp, root, WinGC,
-                              win_x + effect_x_offset + SHADE_X,
-                              win_y + offset + SHADE_Y, line, foreground = 0);
-                }
+    return pixel;
+}
 
-                XSetForeground(disp, WinGC, line->logfile->color);
-                draw_text(disp, root, WinGC, win_x + effect_x_offset,
-                          win_y + offset, line, foreground = 1);
-            }
-        }
+unsigned long GetColor(const char *ColorName)
+{
+    struct color_entry *c;
+    XColor Color;
 
-        if (opt_reverse)
-            offset += step_per_line;
-        offset -= line->logfile->font_ascent;
+    for (c = color_cache; c; c = c->next)
+        if (!strcmp(c->name, ColorName))
+            return c->pixel;
 
-        miny += line->logfile->font_height;
-        maxy -= line->logfile->font_height;
+    if (!colors_ready)
+        init_colors();
 
-        space -= step_per_line;
-    }
+    Color.pixel = 0;
+
+    /* remembered even if it failed, so it isn't complained about again */
+    c = xmalloc(sizeof(struct color_entry));
+    c->allocated = 0;
+
+    if (!XParseColor(disp, colormap, ColorName, &Color))
+        fprintf(stderr, "can't parse %s\n", ColorName);
+    else if (true_color)
+        Color.pixel = true_color_pixel(&Color);
+    else if (!XAllocColor(disp, colormap, &Color))
+        fprintf(stderr, "can't allocate %s\n", ColorName);
+    else
+        c->allocated = 1;
+
+    c->name = xstrdup(ColorName);
+    c->pixel = Color.pixel;
+    c->next = color_cache;
+    color_cache = c;
+
+    return Color.pixel;
+}
+
+/*
+ * forget the colors looked up for the old root: the new one may have
+ * another visual or colormap, so the next GetColor () starts over
+ */
+static void reset_colors(void)
+{
+    struct color_entry *c;
+
+    while ((c = color_cache)) {
+        color_cache = c->next;
+        if (c->allocated)
+            XFreeColors(disp, colormap, &c->pixel, 1, 0);
+        free(c->name);
+        free(c);
+    }
+
+    colors_ready = true_color = 0;
+}
+
+/* the pixels for every file's color, and the continuation's */
+static void lookup_colors(void)
+{
+    struct logfile_entry *e;
+    struct glob_source *g;
+
+    for (e = loglist; e; e = e->next)
+        e->color = GetColor(e->colorname);
+    for (g = globlist; g; g = g->next)
+        g->proto.color = GetColor(g->proto.colorname);
+
+    /* otherwise it is looked up along with the continuation's width */
+    if (continuation_width != -1)
+        continuation_color = GetColor(cont_color);
+}
+
+#if defined(USE_XCB) && !defined(USE_TOON_GET_ROOT_WINDOW)
+/* the window a WINDOW property names, or XCB_NONE.  a window that has
+ * gone away already doesn't name any */
+static xcb_window_t property_window(xcb_connection_t *c,
+                                    xcb_get_property_cookie_t cookie)
+{
+    xcb_generic_error_t *error = NULL;
+    xcb_get_property_reply_t *reply = xcb_get_property_reply(c, cookie, &error);
+    xcb_window_t w = XCB_NONE;
+
+    free(error);
+    if (reply && reply->type == XCB_ATOM_WINDOW
+        && xcb_get_property_value_length(reply) >= (int)sizeof w)
+        memcpy(&w, xcb_get_property_value(reply), sizeof w);
+
+    free(reply);
+    return w;
+}
+
+/*
+ * the same as the Xlib find_root_window () below, but every request that
+ * doesn't need an earlier reply is sent before waiting for any: that
+ * takes 1 round trip (2 for nautilus) instead of 2 plus one per top
+ * level window.  the requests go out on the XCB connection underneath
+ * DISPLAY, so no connection of its own has to be set up.
+ */
+static void find_root_window(Display *display, int screen_number)
+{
+    xcb_connection_t *c = XGetXCBConnection(display);
+    xcb_query_tree_cookie_t tree_cookie;
+    xcb_get_property_cookie_t nautilus_prop, *vroot_props;
+    xcb_query_tree_reply_t *tree, *desktop_tree;
+    xcb_window_t *windows = NULL, desktop;
+    int i, count = 0, waited = 0;
+
+    if (root)
+        return;
+
+    root = RootWindow(display, screen_number);
+    root_parent = None;
+
+    /* the top level windows; the atoms were interned by the caller */
+    tree_cookie = xcb_query_tree(c, root);
+    nautilus_prop = xcb_get_property(c, 0, root, nautilus_atom,
+                                     XCB_ATOM_WINDOW, 0, 1);
+
+    if ((tree = xcb_query_tree_reply(c, tree_cookie, NULL))) {
+        windows = xcb_query_tree_children(tree);
+        count = xcb_query_tree_children_length(tree);
+    } else
+        fprintf(stderr, "Can't query tree on root window 0x%lx", root);
+
+    /* every property that could name the desktop window */
+    vroot_props = xmalloc((count + 1) * sizeof(xcb_get_property_cookie_t));
+    for (i = 0; i < count; i++)
+        vroot_props[i] = xcb_get_property(c, 0, windows[i], swm_vroot_atom,
+                                          XCB_ATOM_WINDOW, 0, 1);
+
+    if ((desktop = property_window(c, nautilus_prop))) {
+        /* nautilus draws on the topmost child of its desktop window */
+        desktop_tree = xcb_query_tree_reply(c, xcb_query_tree(c, desktop), NULL);
+        if (desktop_tree && xcb_query_tree_children_length(desktop_tree)) {
+            root = xcb_query_tree_children(
+                desktop_tree)[xcb_query_tree_children_length(desktop_tree) - 1];
+            root_parent = desktop;
+        }
+        free(desktop_tree);
+    } else {
+        while (waited < count)
+            if ((desktop = property_window(c, vroot_props[waited++]))) {
+                root = desktop;
+                root_parent = windows[waited - 1];
+                break;
+            }
+    }
+
+    /* the connection is shared, so the replies not waited for have to
+     * be thrown away here */
+    for (i = waited; i < count; i++)
+        xcb_discard_reply(c, vroot_props[i].sequence);
+    free(vroot_props);
+    free(tree);
+}
+#elif !defined(USE_TOON_GET_ROOT_WINDOW)
+static void find_root_window(Display *display, int screen_number)
+{
+    if (!root) {
+        Window unused, *windows = 0;
+        unsigned int count;
+
+        Atom type;
+        int format;
+        unsigned long nitems, bytes_after_return;
+        unsigned char *virtual_root_window;
+
+        root = RootWindow(display, screen_number);
+        root_parent = None;
+
+        if (XGetWindowProperty(display, root, nautilus_atom, 0, 1,
+                               False, XA_WINDOW, &type, &format, &nitems,
+                               &bytes_after_return, &virtual_root_window)
+                == Success
+            && type == XA_WINDOW) {
+            Window desktop = *(Window *)virtual_root_window;
+
+            if (XQueryTree(display, desktop, &unused, &unused, &windows,
+                           &count)) {
+                if (count) {
+                    root = windows[count - 1];
+                    root_parent = desktop;
+                }
+                XFree(windows);
+            }
+
+            XFree(virtual_root_window);
+        } else if (XQueryTree(display, root, &unused, &unused, &windows,
+                              &count)) {
+            int i;
+
+            for (i = 0; i < count; i++) {
+                if (XGetWindowProperty(display, windows[i], swm_vroot_atom, 0,
+                                       1, False, XA_WINDOW, &type, &format,
+                                       &nitems, &bytes_after_return,
+                                       &virtual_root_window)
+                        == Success
+                    && type == XA_WINDOW) {
+                    root = *(Window *)virtual_root_window;
+                    root_parent = windows[i];
+                    XFree(virtual_root_window);
+                    break;
+                }
+            }
+
+            XFree(windows);
+        } else
+            fprintf(stderr, "Can't query tree on root window 0x%lx", root);
+    }
+}
+#endif /* USE_TOON_GET_ROOT_WINDOW */
+
+/*
+ * ask for the events that tell us the desktop window changed: nautilus
+ * setting its property on the real root, a top level window being
+ * mapped that could be a virtual root (and its size, to tell), and the
+ * one root was found through going away.  with -bgcache, also the wallpaper changing.
+ * the real root may be root itself.
+ */
+static void select_root_events(void)
+{
+    Window real_root = DefaultRootWindow(disp);
+    long mask = ExposureMask | FocusChangeMask, real_root_mask = 0;
+
+    if (track_root)
+        real_root_mask |= PropertyChangeMask | SubstructureNotifyMask;
+    if (opt_bgcache)
+        real_root_mask |= PropertyChangeMask;
+
+    if (root == real_root)
+        XSelectInput(disp, root, mask | real_root_mask);
+    else {
+        XSelectInput(disp, root, mask);
+        if (real_root_mask)
+            XSelectInput(disp, real_root, real_root_mask);
+    }
+}
+
+/* erase part of the text area, from the -bgcache copy if there is one */
+static void clear_area(int x, int y, int w, int h)
+{
+    if (bg_pixmap)
+        XCopyArea(disp, bg_pixmap, root, bg_gc, x - win_x, y - win_y, w, h,
+                  x, y);
+    else
+        XClearArea(disp, root, x, y, w, h, False);
+}
+
+/* the wallpaper pixmap the desktop has set, or None */
+static Pixmap root_pixmap(void)
+{
+    Atom type;
+    int format;
+    unsigned long nitems, bytes_after_return;
+    unsigned char *data;
+    Pixmap pixmap = None;
+
+    if (XGetWindowProperty(disp, DefaultRootWindow(disp), rootpmap_atom, 0, 1,
+                           False, XA_PIXMAP, &type, &format, &nitems,
+                           &bytes_after_return, &data)
+        != Success)
+        return None;
+
+    if (type == XA_PIXMAP && nitems)
+        pixmap = *(Pixmap *)data;
+
+    XFree(data);
+    return pixmap;
+}
+
+/*
+ * -bgcache: copy the part of the wallpaper under the text area into
+ * bg_pixmap.  it is tiled from the corner of the screen, as the desktop
+ * does, so a small wallpaper repeats instead of leaving part of the copy
+ * unset.  without a usable wallpaper there is no copy, and lines are
+ * erased with XClearArea () again.
+ */
+static void capture_background(void)
+{
+    Window unused;
+    int x, y;
+    unsigned int w, h, border, depth, wallpaper_depth;
+    Pixmap wallpaper = root_pixmap();
+    XGCValues gcv;
+    GC fill_gc;
+
+    if (!XGetGeometry(disp, root, &unused, &x, &y, &w, &h, &border, &depth))
+        return;
+
+    /* the wallpaper may be stale, or not have the depth of root */
+    if (wallpaper
+        && (!XGetGeometry(disp, wallpaper, &unused, &x, &y, &w, &h, &border,
+                          &wallpaper_depth)
+            || wallpaper_depth != depth))
+        wallpaper = None;
+
+    if (bg_pixmap) {
+        XFreePixmap(disp, bg_pixmap);
+        XFreeGC(disp, bg_gc);
+        bg_pixmap = None;
+    }
+
+    if (!wallpaper)
+        return;
+
+    bg_pixmap = XCreatePixmap(disp, root, width + MARGIN_OF_ERROR, height,
+                              depth);
+    gcv.graphics_exposures = False;
+    bg_gc = XCreateGC(disp, bg_pixmap, GCGraphicsExposures, &gcv);
+
+    gcv.fill_style = FillTiled;
+    gcv.tile = wallpaper;
+    gcv.ts_x_origin = -win_x;
+    gcv.ts_y_origin = -win_y;
+    fill_gc = XCreateGC(disp, bg_pixmap,
+                        GCFillStyle | GCTile | GCTileStipXOrigin
+                            | GCTileStipYOrigin,
+                        &gcv);
+    XFillRectangle(disp, bg_pixmap, fill_gc, 0, 0, width + MARGIN_OF_ERROR,
+                   height);
+    XFreeGC(disp, fill_gc);
+}
+
+/* true if WINDOW, a new top level window, makes itself a virtual root */
+static int is_virtual_root(Window window)
+{
+    Atom type;
+    int format;
+    unsigned long nitems, bytes_after_return;
+    unsigned char *data;
+
+    if (XGetWindowProperty(disp, window, swm_vroot_atom, 0, 1, False,
+                           XA_WINDOW, &type, &format, &nitems,
+                           &bytes_after_return, &data)
+        != Success)
+        return 0;
+
+    XFree(data);
+    return type == XA_WINDOW;
+}
+
+/* where WINDOW is in screen_windows, or -1 */
+static int screen_window_index(Window window)
+{
+    int i;
+
+    for (i = 0; i < num_screen_windows; i++)
+        if (screen_windows[i] == window)
+            return i;
+
+    return -1;
+}
+
+static void forget_screen_window(Window window)
+{
+    int i = screen_window_index(window);
+
+    if (i >= 0)
+        screen_windows[i] = screen_windows[--num_screen_windows];
+}
+
+/* note the new geometry of a top level window */
+static void note_window_size(Window window, int x, int y, int w, int h)
+{
+    int screen = DefaultScreen(disp);
+
+    if (x > 0 || y > 0 || x + w < DisplayWidth(disp, screen)
+        || y + h < DisplayHeight(disp, screen))
+        forget_screen_window(window);
+    else if (screen_window_index(window) < 0) {
+        if (num_screen_windows == screen_windows_size) {
+            screen_windows_size = screen_windows_size * 2 + 4;
+            screen_windows = xrealloc(screen_windows,
+                                      screen_windows_size * sizeof(Window));
+        }
+        screen_windows[num_screen_windows++] = window;
+    }
+}
+
+/* look for the desktop window again, and move over to it if it changed */
+static void find_root_again(void)
+{
+    Window old_root = root;
+
+    root = 0;
+    find_root_window(disp, DefaultScreen(disp));
+
+    if (root != old_root) {
+        /* if the old window is gone already, the error is ignored */
+        if (old_root != DefaultRootWindow(disp))
+            XSelectInput(disp, old_root, NoEventMask);
+
+        select_root_events();
+        reset_colors();
+        lookup_colors();
+        if (opt_bgcache)
+            capture_background();
+        redraw(1);
+    }
+}
+
+/*
+ * windows can go away between an event and our request about them,
+ * most of all the desktop we draw on when it is restarted: that is
+ * noticed through its DestroyNotify, so the errors are ignored.  so is
+ * the colormap of a desktop that went away, when its colors are freed.
+ * a window given with -id is never replaced though, so there they are
+ * as fatal as ever.
+ */
+static int (*default_x_error)(Display *, XErrorEvent *);
+
+static int x_error(Display *display, XErrorEvent *error)
+{
+    if (track_root
+        && (error->error_code == BadWindow || error->error_code == BadDrawable
+            || error->error_code == BadColor))
+        return 0;
+
+    return default_x_error(display, error);
+}
+
+/*
+ * the width of the printable ASCII characters in FONTSET, if they are
+ * all the same, so that runs of them can be measured by counting them.
+ * returns 0 for proportional fonts, and in locales where a byte that
+ * looks like ASCII could be part of a multibyte character.
+ */
+static int fixed_width(XFontSet fontset)
+{
+    int w, c;
+    char ch;
+
+    if (!utf8_locale && MB_CUR_MAX > 1)
+        return 0;
+
+    ch = ' ';
+    w = XmbTextEscapement(fontset, &ch, 1);
+
+    for (c = ' ' + 1; c <= '~'; c++) {
+        ch = c;
+        if (XmbTextEscapement(fontset, &ch, 1) != w)
+            return 0;
+    }
+
+    return w;
+}
+
+static void init_font(struct logfile_entry *e)
+{
+    char **missing_charset_list;
+    int missing_charset_count;
+    char *def_string;
+
+    e->fontset = XCreateFontSet(disp, e->fontname, &missing_charset_list,
+                                &missing_charset_count, &def_string);
+
+    if (missing_charset_count) {
+        fprintf(stderr,
+                "Missing charsets in String to FontSet conversion (%s)\n",
+                missing_charset_list[0]);
+        XFreeStringList(missing_charset_list);
+    }
+
+    if (!e->fontset) {
+        fprintf(stderr, "unable to create fontset for font '%s', exiting.\n",
+                e->fontname);
+        exit(1);
+    }
+
+    {
+        XFontSetExtents *xfe = XExtentsOfFontSet(e->fontset);
+
+        e->font_height = xfe->max_logical_extent.height;
+        e->font_ascent = -xfe->max_logical_extent.y;
+    }
+
+    e->char_width = fixed_width(e->fontset);
+
+    if (e->font_height > height - effect_y_space) {
+        fprintf(stderr,
+                "\n  the display isn't tall enough to display a single "
+                "line in font '%s'\n",
+                e->fontname);
+        fprintf(stderr, "\n  the geometry in use is %d pixels tall\n", height);
+        fprintf(stderr, "\n  font '%s' is %d pixels tall\n", e->fontname,
+                e->font_height);
+        if (effect_y_space)
+            fprintf(stderr,
+                    "\n  the shade or outline options need an extra %d "
+                    "pixel%s of vertical space\n",
+                    effect_y_space, effect_y_space == 1 ? "" : "s");
+        fprintf(stderr, "\n");
+        exit(1);
+    }
+}
+
+void InitWindow(void)
+{
+    XGCValues gcv;
+    unsigned long gcm;
+    int screen, ScreenWidth, ScreenHeight;
+    struct logfile_entry *e;
+    struct glob_source *g;
+
+    if (!(disp = XOpenDisplay(dispname))) {
+        fprintf(stderr, "Can't open display %s.\n", dispname);
+        exit(1);
+    }
+
+    screen = DefaultScreen(disp);
+    ScreenHeight = DisplayHeight(disp, screen);
+    ScreenWidth = DisplayWidth(disp, screen);
+
+    default_x_error = XSetErrorHandler(x_error);
+
+    {
+        char *names[] = { "__SWM_VROOT", "NAUTILUS_DESKTOP_WINDOW_ID",
+                          "_XROOTPMAP_ID" };
+        Atom atoms[3];
+
+        XInternAtoms(disp, names, 3, False, atoms);
+        swm_vroot_atom = atoms[0];
+        nautilus_atom = atoms[1];
+        rootpmap_atom = atoms[2];
+    }
+
+    track_root = !root;
+    find_root_window(disp, screen);
+
+    gcm = GCBackground;
+    gcv.graphics_exposures = True;
+    WinGC = XCreateGC(disp, root, gcm, &gcv);
+    XMapWindow(disp, root);
+
+    XSetForeground(disp, WinGC, GetColor(DEF_COLOR));
+
+    for (e = loglist; e; e = e->next)
+        init_font(e);
+    for (g = globlist; g; g = g->next)
+        init_font(&g->proto);
+
+    if (geom_mask & XNegative)
+        win_x = win_x + ScreenWidth - width;
+    if (geom_mask & YNegative)
+        win_y = win_y + ScreenHeight - height;
+
+    lookup_colors();
+
+    select_root_events();
+
+    if (opt_bgcache)
+        capture_background();
+}
+
+/*
+ * if redraw () is passwd a non-zero argument, it does a complete
+ * redraw, rather than an update.  if the argument is zero (and
+ * -noflicker is in effect) then only the lines which have changed
+ * since the last draw are redrawn.
+ *
+ * the rest is handled by regular refresh ()'es
+ */
+void redraw(int redraw_all)
+{
+    XSetClipMask(disp, WinGC, None);
+    refresh(0, 32768, 1, redraw_all);
+}
+
+void draw_text(Display *disp, Window root, GC WinGC, int x, int y,
+               struct line_node *line, int foreground)
+{
+    if (line->words) {
+        XmbDrawText(disp, root, WinGC,
+                    x + continuation_width * line->wrapped_left, y,
+                    line->words, line->num_words);
+
+        if (line->wrapped_left) {
+            if (foreground)
+                XSetForeground(disp, WinGC, continuation_color);
+            XmbDrawString(disp, root, line->logfile->fontset, WinGC, x, y,
+                          continuation, continuation_length);
+        }
+    } else {
+        XmbDrawString(disp, root, line->logfile->fontset, WinGC,
+                      x + continuation_width * line->wrapped_left, y,
+                      line->line, line->len);
+
+        if (line->wrapped_left) {
+            if (foreground)
+                XSetForeground(disp, WinGC, continuation_color);
+            XmbDrawString(disp, root, line->logfile->fontset, WinGC, x, y,
+                          continuation, continuation_length);
+        }
+    }
+}
+
+/* the variants of the loop in refresh (), see refresh.h */
+#define EFFECT_NONE 0
+#define EFFECT_OUTLINE 1
+#define EFFECT_SHADE 2
+
+#define DRAW_ROWS draw_rows_plain
+#define NOFLICKER 0
+#define EFFECT EFFECT_NONE
+#define REVERSE 0
+#include "refresh.h"
+#define DRAW_ROWS draw_rows_plain_reverse
+#define NOFLICKER 0
+#define EFFECT EFFECT_NONE
+#define REVERSE 1
+#include "refresh.h"
+#define DRAW_ROWS draw_rows_outline
+#define NOFLICKER 0
+#define EFFECT EFFECT_OUTLINE
+#define REVERSE 0
+#include "refresh.h"
+#define DRAW_ROWS draw_rows_outline_reverse
+#define NOFLICKER 0
+#define EFFECT EFFECT_OUTLINE
+#define REVERSE 1
+#include "refresh.h"
+#define DRAW_ROWS draw_rows_shade
+#define NOFLICKER 0
+#define EFFECT EFFECT_SHADE
+#define REVERSE 0
+#include "refresh.h"
+#define DRAW_ROWS draw_rows_shade_reverse
+#define NOFLICKER 0
+#define EFFECT EFFECT_SHADE
+#define REVERSE 1
+#include "refresh.h"
+#define DRAW_ROWS draw_rows_plain_noflicker
+#define NOFLICKER 1
+#define EFFECT EFFECT_NONE
+#define REVERSE 0
+#include "refresh.h"
+#define DRAW_ROWS draw_rows_plain_noflicker_reverse
+#define NOFLICKER 1
+#define EFFECT EFFECT_NONE
+#define REVERSE 1
+#include "refresh.h"
+#define DRAW_ROWS draw_rows_outline_noflicker
+#define NOFLICKER 1
+#define EFFECT EFFECT_OUTLINE
+#define REVERSE 0
+#include "refresh.h"
+#define DRAW_ROWS draw_rows_outline_noflicker_reverse
+#define NOFLICKER 1
+#define EFFECT EFFECT_OUTLINE
+#define REVERSE 1
+#include "refresh.h"
+#define DRAW_ROWS draw_rows_shade_noflicker
+#define NOFLICKER 1
+#define EFFECT EFFECT_SHADE
+#define REVERSE 0
+#include "refresh.h"
+#define DRAW_ROWS draw_rows_shade_noflicker_reverse
+#define NOFLICKER 1
+#define EFFECT EFFECT_SHADE
+#define REVERSE 1
+#include "refresh.h"
+
+/* indexed by -noflicker, the effect and -reverse */
+static struct line_node *(*const draw_rows_variants[2][3][2])(
+    int, int, int, int, int *, int *) = {
+    {{draw_rows_plain, draw_rows_plain_reverse},
+     {draw_rows_outline, draw_rows_outline_reverse},
+     {draw_rows_shade, draw_rows_shade_reverse}},
+    {{draw_rows_plain_noflicker, draw_rows_plain_noflicker_reverse},
+     {draw_rows_outline_noflicker, draw_rows_outline_noflicker_reverse},
+     {draw_rows_shade_noflicker, draw_rows_shade_noflicker_reverse}},
+};
+
+/* the one for the options in effect */
+static struct line_node *(*draw_rows)(int, int, int, int, int *, int *);
+
+static void select_draw_rows(void)
+{
+    int effect = opt_outline ? EFFECT_OUTLINE
+                 : opt_shade ? EFFECT_SHADE
+                             : EFFECT_NONE;
+
+    draw_rows
+        = draw_rows_variants[!!opt_noflicker][effect][!!opt_reverse];
+}
+
+/* Just redraw everything without clearing (i.e. after an EXPOSE event) */
+void refresh(int miny, int maxy, int clear, int refresh_all)
+{
+    int space = height;
+    int offset;
+    struct line_node *line;
+
+    TRACE_BEGIN("refresh");
+
+    stats.redraws++;
+
+    if (opt_reverse)
+        offset = effect_y_offset;
+    else
+        offset = height + effect_y_offset;
+
+    miny -= win_y;
+    maxy -= win_y;
+
+    if (clear && !opt_noflicker)
+        clear_area(win_x, win_y, width + MARGIN_OF_ERROR, height);
+
+    line = draw_rows(miny, maxy, clear, refresh_all, &offset, &space);
+
+    if (stats.redraws == 1)
+        stats.first_frame_ms = mono_ms() - stats.start_ms;
 
     if (space > 0 && clear) {
 #ifdef DEBUG
@@ -536,620 +1571,2733 @@ void refresh(int miny, int maxy, int clear, int refresh_all)
                        win_y + offset - (opt_reverse ? 0 : space), width,
                        space);
 #else /* DEBUG */
-        XClearArea(disp, root, win_x,
-                   win_y + offset - (opt_reverse ? 0 : space),
-                   width + MARGIN_OF_ERROR, space, False);
+        clear_area(win_x, win_y + offset - (opt_reverse ? 0 : space),
+                   width + MARGIN_OF_ERROR, space);
+#endif
+    }
+
+    /* at least one of the lines must fit in the allocated area.  we've
+     * already checked at initialisation time that all the fonts are small
+     * enough to fit at least one line in the display area, but assert it
+     * again here to be sure */
+    assert(line != linelist);
+
+    /* any lines that didn't just get looked at are never going to be, so break
+     * the chain */
+    if (line)
+        line->prev->next = 0;
+
+    /* and throw them all away */
+    while (line) {
+        struct line_node *this = line;
+        line = line->next;
+        if (this->logfile && this->logfile->last == this)
+            this->logfile->last = NULL;
+        free(this->line);
+        free(this->breaks);
+        free(this->words);
+        free(this);
+        stats.lines_dropped++;
+    }
+
+    if (opt_frame) {
+        XSetForeground(disp, WinGC, GetColor(def_color));
+        /* note that XDrawRectangle() draws a rectangle one pixel bigger
+         * in both dimensions than you ask for, hence the subtractions.
+         * XFillRectangle() doesn't suffer from this problem */
+        XDrawRectangle(disp, root, WinGC, win_x - 0, win_y - 0, width - 1,
+                       height - 1);
+    }
+
+    TRACE_END();
+}
+
+#if HAS_REGEX
+void transform_line(char *s)
+{
+#ifdef I_AM_Md
+    int i;
+    if (1) {
+        for (i = 16; s[i]; i++)
+            s[i] = s[i + 11];
+    }
+    s[i + 1] = '\0';
+#endif
+
+    if (transformre) {
+        int i;
+        regmatch_t matched[16];
+
+        i = regexec(transformre, s, 16, matched, 0);
+        if (i == 0) { /* matched */
+            int match_start = matched[0].rm_so;
+            int match_end = matched[0].rm_eo;
+            int old_len = match_end - match_start;
+            int new_len = strlen(transform_to);
+            int old_whole_len = strlen(s);
+
+            printf("regexp was matched by '%s' - replace with '%s'\n", s,
+                   transform_to);
+            printf("match is from %d to %d\n", match_start, match_end);
+            if (new_len > old_len)
+                s = xrealloc(s, old_whole_len + new_len - old_len);
+
+            if (new_len != old_len) {
+                memcpy(s + match_end + new_len - old_len, s + match_end,
+                       old_whole_len - match_end);
+                s[old_whole_len + new_len - old_len] = '\0';
+            }
+
+            memcpy(s + match_start, transform_to, new_len);
+            printf("transformed to '%s'\n", s);
+        } else
+            printf("regexp was not matched by '%s'\n", s);
+    }
+}
+#endif
+
+/*
+ * appends p2 to the end of p1, if p1 is not null
+ * otherwise allocates a new string and copies p2 to it
+ */
+char *concat_line(char *p1, const char *p2)
+{
+    int l1 = p1 ? strlen(p1) : 0;
+    int l2 = strlen(p2);
+    char *r;
+
+    assert(p2);
+
+    if (p1)
+        r = xrealloc(p1, l1 + l2 + 1);
+    else
+        r = xmalloc(l2 + 1);
+
+    memcpy(r + l1, p2, l2);
+    r[l1 + l2] = 0;
+
+    return r;
+}
+
+/*
+ * append LEN bytes to the line being read into logfile->buf.  a line
+ * that fits into one read gets a buffer of just the right size; longer
+ * ones grow geometrically.
+ */
+static void append_input(struct logfile_entry *logfile, const char *s, int len)
+{
+    if (logfile->buf_len + len + 1 > logfile->buf_size) {
+        if (!logfile->buf_size)
+            logfile->buf_size = len + 1;
+        while (logfile->buf_len + len + 1 > logfile->buf_size)
+            logfile->buf_size *= 2;
+        logfile->buf = xrealloc(logfile->buf, logfile->buf_size);
+    }
+
+    memcpy(logfile->buf + logfile->buf_len, s, len);
+    logfile->buf_len += len;
+    logfile->buf[logfile->buf_len] = '\0';
+}
+
+/*
+ * This routine can read a line of any length if it is called enough times.
+ * With -maxline, only the first that many bytes of it are kept; the rest
+ * is read and thrown away, and the line ends in TRUNCATE_MARK.
+ */
+int lineinput(struct logfile_entry *logfile)
+{
+    char buff[1024], *p, *end;
+    int ch, room, dropped;
+    /* HACK-2: add on the length of any partial line which we will be appending
+     * to */
+    int ofs;
+    unsigned long start = logfile->bytes_read;
+
+    TRACE_BEGIN("lineinput");
+
+    /* a buffer that was handed on isn't ours any more */
+    if (!logfile->buf)
+        logfile->buf_len = logfile->buf_size = 0;
+    ofs = logfile->buf_len;
+
+    /* this loop ensures that the whole line is read, even if it's
+     * longer than the buffer.  we need to do this because when --whole
+     * is in effect we don't know whether to display the line or not
+     * until we've seen how (ie. whether) it ends */
+    do {
+        /* what's left of -maxline; past it, characters are only counted */
+        room = max_line ? max_line - logfile->line_len : (int)sizeof buff;
+        if (room > (int)sizeof buff - 8 - 1)
+            room = sizeof buff - 8 - 1;
+        end = buff + (room > 0 ? room : 0);
+        dropped = 0;
+
+        p = buff;
+        do {
+            ch = fgetc(logfile->fp);
+
+            if (ch == EOF)
+                break;
+
+            logfile->bytes_read++;
+
+            if (ch == '\n')
+                break;
+            else if (ch == '\r')
+                continue; /* skip */
+            else if (p >= end)
+                dropped = 1;
+            else if (ch == '\t') {
+                do {
+                    *p++ = ' ';
+                    ofs++;
+                } while (ofs & 7);
+            } else {
+                *p++ = ch;
+                ofs++;
+            }
+        } while (p < buff + (sizeof buff) - 8 - 1);
+
+        if (p == buff && ch == EOF && logfile->bytes_read == start) {
+            TRACE_END();
+            return 0;
+        }
+
+        logfile->line_len += p - buff;
+        append_input(logfile, buff, p - buff);
+
+        if (dropped && !logfile->truncated) {
+            logfile->truncated = 1;
+            append_input(logfile, TRUNCATE_MARK, strlen(TRUNCATE_MARK));
+        }
+    } while (ch != '\n' && ch != EOF);
+
+    logfile->lastpartial = logfile->partial;
+    /* there are 3 ways we could have exited the loop: reading '\n',
+     * reaching EOF, or filling the buffer; the 2nd and 3rd of these
+     * both result in a partial line */
+    logfile->partial = ch != '\n';
+
+    if (!logfile->partial) {
+        logfile->lines_read++;
+        logfile->line_len = logfile->truncated = 0;
+    }
+
+    if (logfile->partial && opt_whole) {
+        logfile->pending_bytes += logfile->bytes_read - start;
+        TRACE_END();
+        return 0;
+    }
+
+    logfile->pending_bytes = 0;
+
+#if HAS_REGEX
+    transform_line(logfile->buf);
+#endif
+    TRACE_END();
+    return 1;
+}
+
+/*
+ * copy LEN bytes of a message from SRC to DST (which may be the same
+ * buffer, as long as DST <= SRC), turning control characters (tabs and
+ * newlines mostly) into spaces.  returns the end of the copy, where a
+ * '\0' has been put.
+ */
+static char *copy_printable(char *dst, const char *src, int len)
+{
+    const char *end = src + len;
+
+    while (src < end) {
+        *dst++ = (unsigned char)*src < ' ' ? ' ' : *src;
+        src++;
+    }
+
+    *dst = '\0';
+    return dst;
+}
+
+/*
+ * open a -syslog source: a unix datagram socket at PATH, or a UDP
+ * socket on the loopback interface for "udp:PORT"
+ */
+static struct syslog_batch *open_syslog(const char *path)
+{
+    struct syslog_batch *b = xmalloc(sizeof(struct syslog_batch));
+    int r;
+
+    memset(b, 0, sizeof(struct syslog_batch));
+
+    if (!strncmp(path, "udp:", 4)) {
+        struct sockaddr_in addr;
+
+        memset(&addr, 0, sizeof addr);
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(atoi(path + 4));
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        b->fd = socket(AF_INET, SOCK_DGRAM, 0);
+        r = b->fd < 0 ? -1 : bind(b->fd, (struct sockaddr *)&addr, sizeof addr);
+    } else {
+        struct sockaddr_un addr;
+        struct stat st;
+
+        if (strlen(path) >= sizeof addr.sun_path) {
+            fprintf(stderr, "syslog socket name '%s' is too long\n", path);
+            exit(1);
+        }
+
+        memset(&addr, 0, sizeof addr);
+        addr.sun_family = AF_UNIX;
+        strcpy(addr.sun_path, path);
+
+        /* like syslogd, take over a socket an earlier run left behind,
+         * but nothing else: not another file, not somebody else's
+         * socket, and not one that is still listened on (/dev/log) */
+        if (lstat(path, &st) == 0) {
+            int probe;
+
+            if (!S_ISSOCK(st.st_mode) || st.st_uid != geteuid()) {
+                fprintf(stderr, "%s: exists and isn't our socket, not "
+                                "replacing it\n", path);
+                exit(1);
+            }
+
+            if ((probe = socket(AF_UNIX, SOCK_DGRAM, 0)) >= 0) {
+                r = connect(probe, (struct sockaddr *)&addr, sizeof addr);
+                close(probe);
+                if (r == 0) {
+                    fprintf(stderr, "%s: in use by another program\n", path);
+                    exit(1);
+                }
+            }
+
+            unlink(path);
+        }
+
+        /* let everybody log to it */
+        b->fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+        r = b->fd < 0 ? -1 : bind(b->fd, (struct sockaddr *)&addr, sizeof addr);
+        if (r == 0) {
+            b->path = xstrdup(path);
+            r = chmod(path, 0666);
+        }
+    }
+
+    if (r < 0 || fcntl(b->fd, F_SETFL, O_NONBLOCK) < 0)
+        perror(path), exit(1);
+
+    return b;
+}
+
+/*
+ * like lineinput (), but for -syslog sources: every message is a line.
+ * messages are received a batch at a time, straight into the buffers
+ * that become the lines' text.
+ */
+static int syslog_input(struct logfile_entry *logfile)
+{
+    struct syslog_batch *b = logfile->syslog;
+    char *buf, *p, *q;
+    int i, len, truncated;
+
+    if (b->next == b->count) {
+        int n;
+
+        for (i = 0; i < SYSLOG_BATCH; i++) {
+            if (!b->bufs[i])
+                b->bufs[i] = xmalloc(SYSLOG_MSG_SIZE + sizeof TRUNCATE_MARK);
+            b->iovs[i].iov_base = b->bufs[i];
+            b->iovs[i].iov_len = SYSLOG_MSG_SIZE;
+#if HAS_RECVMMSG
+            memset(&b->hdrs[i].msg_hdr, 0, sizeof(struct msghdr));
+            b->hdrs[i].msg_hdr.msg_iov = b->iovs + i;
+            b->hdrs[i].msg_hdr.msg_iovlen = 1;
+#endif
+        }
+
+#if HAS_RECVMMSG
+        n = recvmmsg(b->fd, b->hdrs, SYSLOG_BATCH, MSG_DONTWAIT, NULL);
+#else
+        for (n = 0; n < SYSLOG_BATCH; n++) {
+            struct msghdr hdr;
+
+            memset(&hdr, 0, sizeof hdr);
+            hdr.msg_iov = b->iovs + n;
+            hdr.msg_iovlen = 1;
+
+            if ((b->lens[n] = recvmsg(b->fd, &hdr, 0)) < 0)
+                break;
+            b->truncated[n] = hdr.msg_flags & MSG_TRUNC;
+        }
+#endif
+        if (n <= 0)
+            return 0;
+
+        b->count = n;
+        b->next = 0;
+    }
+
+    i = b->next++;
+    buf = b->bufs[i];
+    b->bufs[i] = NULL;
+#if HAS_RECVMMSG
+    len = b->hdrs[i].msg_len;
+    truncated = b->hdrs[i].msg_hdr.msg_flags & MSG_TRUNC;
+#else
+    len = b->lens[i];
+    truncated = b->truncated[i];
+#endif
+
+    logfile->bytes_read += len;
+
+    /* drop the line end or NUL some senders add */
+    while (len > 0 && (buf[len - 1] == '\n' || buf[len - 1] == '\r'
+                       || buf[len - 1] == '\0'))
+        len--;
+    buf[len] = '\0';
+
+    /* drop the "<priority>" in front */
+    p = buf;
+    if (*p == '<') {
+        q = p + 1;
+        while (isdigit((unsigned char)*q) && q < p + 4)
+            q++;
+        if (*q == '>')
+            p = q + 1;
+    }
+
+    /* move the text into place; shrinking is done in place */
+    q = copy_printable(buf, p, buf + len - p);
+
+    /* the rest of a message longer than SYSLOG_MSG_SIZE was lost */
+    if (truncated) {
+        strcpy(q, TRUNCATE_MARK);
+        q += strlen(TRUNCATE_MARK);
+    }
+
+    logfile->buf = xrealloc(buf, q - buf + 1);
+    logfile->lastpartial = logfile->partial = 0;
+    logfile->lines_read++;
+
+#if HAS_REGEX
+    transform_line(logfile->buf);
+#endif
+    return 1;
+}
+
+#if HAS_RING
+/*
+ * like lineinput (), but for -ring sources: the lines are copied out
+ * of the shared memory ring
+ */
+static int ring_input(struct logfile_entry *logfile)
+{
+    unsigned int len;
+    const char *line = rt_ring_peek(logfile->ring, &len);
+
+    if (!line)
+        return 0;
+
+    logfile->bytes_read += len;
+
+    while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+        len--;
+
+    logfile->buf = xmalloc(len + 1);
+    copy_printable(logfile->buf, line, len);
+    rt_ring_release(logfile->ring);
+
+    logfile->lastpartial = logfile->partial = 0;
+    logfile->lines_read++;
+
+#if HAS_REGEX
+    transform_line(logfile->buf);
+#endif
+    return 1;
+}
+#endif
+
+/* read the next line from whatever kind of source this is */
+static int source_input(struct logfile_entry *logfile)
+{
+    if (logfile->syslog)
+        return syslog_input(logfile);
+#if HAS_RING
+    if (logfile->ring)
+        return ring_input(logfile);
+#endif
+    return lineinput(logfile);
+}
+
+#if HAS_EPOLL
+/*
+ * inotify only sees the changes made through this kernel, which on
+ * network and FUSE filesystems may well be none of them
+ */
+static int remote_fs(int fd)
+{
+    struct statfs sfs;
+
+    if (fstatfs(fd, &sfs) < 0)
+        return 0;
+
+    switch ((unsigned long)sfs.f_type & 0xffffffffUL) {
+    case 0x6969:     /* NFS */
+    case 0x65735546: /* FUSE */
+    case 0x517b:     /* SMB */
+    case 0xff534d42: /* CIFS */
+    case 0xfe534d42: /* SMB2 */
+    case 0x00c36400: /* CEPH */
+    case 0x01021997: /* 9P */
+        return 1;
+    }
+
+    return 0;
+}
+
+static void set_watch(int wd, struct logfile_entry *log,
+                      struct glob_source *glob)
+{
+    if (wd < 0)
+        return;
+
+    if (wd >= watches_size) {
+        int i = watches_size;
+
+        watches_size = wd * 2 + 16;
+        watches = xrealloc(watches, watches_size * sizeof(struct watch));
+        for (; i < watches_size; i++) {
+            watches[i].log = NULL, watches[i].glob = NULL;
+            watches[i].dir = NULL;
+        }
+    }
+
+    watches[wd].log = log;
+    watches[wd].glob = glob;
+}
+
+static void unwatch_file(struct logfile_entry *e)
+{
+    if (e->wd < 0)
+        return;
+
+    inotify_rm_watch(inotify_fd, e->wd);
+    set_watch(e->wd, NULL, NULL);
+    e->wd = -1;
+}
+
+/* (re)watch a file we have just opened, unless it has to be polled */
+static void watch_file(struct logfile_entry *e)
+{
+    unwatch_file(e);
+
+    if (remote_fs(fileno(e->fp)))
+        return;
+
+    e->wd = inotify_add_watch(inotify_fd, e->fname,
+                              IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF
+                                  | IN_DELETE_SELF);
+    set_watch(e->wd, e, NULL);
+}
+#endif
+
+#if HAS_EPOLL
+/* a file that isn't open can only be found again by polling, whatever
+ * watch it still has on an inode it let go of */
+#define file_is_watched(e) (((e)->wd >= 0 && (e)->fp) || (e)->source)
+#else
+#define file_is_watched(e) 0
+#endif
+
+static long long mono_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static long long interval_ms(void)
+{
+    return interval.tv_sec * 1000LL + interval.tv_usec / 1000;
+}
+
+/* how soon a file that has just had new data is polled again */
+static long long poll_min_ms(void)
+{
+    return POLL_MIN_MS < interval_ms() ? POLL_MIN_MS : interval_ms();
+}
+
+static void poll_heap_fix(int i)
+{
+    struct logfile_entry *e = poll_heap[i];
+
+    while (i > 0 && poll_heap[(i - 1) / 2]->poll_at > e->poll_at) {
+        poll_heap[i] = poll_heap[(i - 1) / 2];
+        poll_heap[i]->poll_index = i;
+        i = (i - 1) / 2;
+    }
+
+    for (;;) {
+        int c = 2 * i + 1;
+
+        if (c >= poll_heap_len)
+            break;
+        if (c + 1 < poll_heap_len
+            && poll_heap[c + 1]->poll_at < poll_heap[c]->poll_at)
+            c++;
+        if (poll_heap[c]->poll_at >= e->poll_at)
+            break;
+
+        poll_heap[i] = poll_heap[c];
+        poll_heap[i]->poll_index = i;
+        i = c;
+    }
+
+    poll_heap[i] = e;
+    e->poll_index = i;
+}
+
+/* poll a file MS milliseconds from now (and not at the time set before) */
+static void schedule_poll(struct logfile_entry *e, long long ms)
+{
+    e->poll_ms = ms;
+    e->poll_at = mono_ms() + ms;
+
+    if (e->poll_index < 0) {
+        if (poll_heap_len == poll_heap_size) {
+            poll_heap_size = poll_heap_size * 2 + 16;
+            poll_heap = xrealloc(poll_heap, poll_heap_size
+                                                * sizeof(struct logfile_entry *));
+        }
+
+        e->poll_index = poll_heap_len++;
+        poll_heap[e->poll_index] = e;
+    }
+
+    poll_heap_fix(e->poll_index);
+}
+
+static struct logfile_entry *poll_heap_pop(void)
+{
+    struct logfile_entry *e = poll_heap[0];
+
+    e->poll_index = -1;
+    if (--poll_heap_len > 0) {
+        poll_heap[0] = poll_heap[poll_heap_len];
+        poll_heap_fix(0);
+    }
+
+    return e;
+}
+
+/* files nothing tells us about have to be polled */
+static void poll_unwatched(struct logfile_entry *e)
+{
+    if (!file_is_watched(e) && e->poll_index < 0)
+        schedule_poll(e, poll_min_ms());
+}
+
+void mark_ready(struct logfile_entry *e)
+{
+    if (e->ready)
+        return;
+
+    e->ready = 1;
+    e->ready_next = NULL;
+    if (ready_tail)
+        ready_tail->ready_next = e;
+    else
+        ready_head = e;
+    ready_tail = e;
+}
+
+void mark_recheck(struct logfile_entry *e)
+{
+    if (e->recheck)
+        return;
+
+    e->recheck = 1;
+    e->recheck_next = NULL;
+    if (recheck_tail)
+        recheck_tail->recheck_next = e;
+    else
+        recheck_head = e;
+    recheck_tail = e;
+}
+
+static unsigned int hash_name(const char *s)
+{
+    unsigned int h = 2166136261u;
+
+    while (*s)
+        h = (h ^ (unsigned char)*s++) * 16777619u;
+
+    return h % FILE_HASH_SIZE;
+}
+
+static struct logfile_entry *find_file(const char *fname)
+{
+    struct logfile_entry *e;
+
+    for (e = file_hash[hash_name(fname)]; e; e = e->hash_next)
+        if (!strcmp(e->fname, fname))
+            return e;
+
+    return NULL;
+}
+
+/* add a file to the end of loglist (and to the hash if it has a name) */
+static void add_file(struct logfile_entry *e)
+{
+    e->next = NULL;
+    e->prev = loglist_tail;
+
+    if (!loglist)
+        loglist = e;
+    if (loglist_tail)
+        loglist_tail->next = e;
+
+    loglist_tail = e;
+
+    if (e->fname) {
+        unsigned int h = hash_name(e->fname);
+
+        e->hash_next = file_hash[h];
+        file_hash[h] = e;
+    }
+}
+
+/*
+ * make a new logfile entry; everything not given starts out cleared
+ */
+static struct logfile_entry *new_logfile(const char *fname, const char *desc,
+                                         const char *colorname,
+                                         const char *fontname)
+{
+    struct logfile_entry *e = xmalloc(sizeof(struct logfile_entry));
+
+    memset(e, 0, sizeof(struct logfile_entry));
+
+    e->fname = fname ? xstrdup(fname) : NULL;
+    e->desc = xstrdup(desc);
+    e->colorname = colorname;
+    e->fontname = fontname;
+
+    e->header_len = strlen(e->desc) + 2;
+    e->header = xmalloc(e->header_len + 1);
+    sprintf(e->header, "[%s]", e->desc);
+    e->header_width = -1;
+
+    e->poll_index = -1;
+    e->state_index = -1;
+#if HAS_EPOLL
+    e->wd = -1;
+#endif
+
+    return e;
+}
+
+static void free_logfile(struct logfile_entry *e)
+{
+    free(e->fname);
+    free(e->desc);
+    free(e->header);
+    free(e);
+}
+
+/*
+ * a file argument that doesn't exist but has wildcards in it, or is a
+ * directory, is a pattern for files to tail
+ */
+static int is_pattern(const char *fname)
+{
+    struct stat st;
+
+    if (stat(fname, &st) < 0)
+        return strpbrk(fname, "*?[") != NULL;
+
+    return S_ISDIR(st.st_mode);
+}
+
+#if HAS_EPOLL
+/* watch all directories matching DIR for files turning up in them */
+static void watch_dirs(struct glob_source *g, const char *dir)
+{
+    glob_t gl;
+    size_t i;
+
+    if (glob(dir, GLOB_ONLYDIR, NULL, &gl) != 0)
+        return;
+
+    for (i = 0; i < gl.gl_pathc; i++) {
+        int wd = inotify_add_watch(inotify_fd, gl.gl_pathv[i],
+                                   IN_CREATE | IN_MOVED_TO | IN_DELETE
+                                       | IN_MOVED_FROM | IN_ONLYDIR);
+
+        if (wd < 0)
+            continue;
+
+        set_watch(wd, NULL, g);
+        free(watches[wd].dir);
+        watches[wd].dir = xstrdup(gl.gl_pathv[i]);
+    }
+
+    globfree(&gl);
+}
+#endif
+
+/* start tailing a file that matches pattern G */
+static void add_match(struct glob_source *g, const char *fname, int initial)
+{
+    struct logfile_entry *e;
+
+    e = new_logfile(fname, g->proto.desc ? g->proto.desc : fname,
+                    g->proto.colorname, g->proto.fontname);
+    e->glob = g;
+    e->fontset = g->proto.fontset;
+    e->font_height = g->proto.font_height;
+    e->font_ascent = g->proto.font_ascent;
+    e->char_width = g->proto.char_width;
+    e->color = g->proto.color;
+
+    if (openlog(e) == NULL) {
+        free_logfile(e);
+        return;
+    }
+
+    if (!initial)
+        fseek(e->fp, 0, SEEK_SET);
+
+    add_file(e);
+}
+
+/*
+ * forget a file that matched a pattern and has gone.  what was left
+ * of it is shown first; its lines on the screen are handed over to the
+ * pattern, which has the same font and color.  returns true if there
+ * was anything left to show.
+ */
+static int drop_match(struct logfile_entry *e)
+{
+    struct logfile_entry **p, *prev, *q;
+    struct line_node *line;
+    int got = 0;
+
+    if (e->fp) {
+        clearerr(e->fp);
+        while (source_input(e)) {
+            display_buf(e);
+            got = 1;
+        }
+        fclose(e->fp);
+    }
+
+#if HAS_EPOLL
+    unwatch_file(e);
+#endif
+
+    if (e->ready) {
+        for (prev = NULL, q = ready_head; q != e; prev = q, q = q->ready_next)
+            ;
+        if (prev)
+            prev->ready_next = e->ready_next;
+        else
+            ready_head = e->ready_next;
+        if (ready_tail == e)
+            ready_tail = prev;
+    }
+
+    if (e->recheck) {
+        for (prev = NULL, q = recheck_head; q != e;
+             prev = q, q = q->recheck_next)
+            ;
+        if (prev)
+            prev->recheck_next = e->recheck_next;
+        else
+            recheck_head = e->recheck_next;
+        if (recheck_tail == e)
+            recheck_tail = prev;
+    }
+
+    if (e->poll_index >= 0 && e->poll_index < --poll_heap_len) {
+        poll_heap[e->poll_index] = poll_heap[poll_heap_len];
+        poll_heap_fix(e->poll_index);
+    }
+
+    for (p = &file_hash[hash_name(e->fname)]; *p != e; p = &(*p)->hash_next)
+        ;
+    *p = e->hash_next;
+
+    if (e->prev)
+        e->prev->next = e->next;
+    else
+        loglist = e->next;
+    if (e->next)
+        e->next->prev = e->prev;
+    else
+        loglist_tail = e->prev;
+
+    for (line = linelist; line; line = line->next)
+        if (line->logfile == e)
+            line->logfile = &e->glob->proto;
+    if (lastprinted == e)
+        lastprinted = NULL;
+
+    free(e->buf);
+    free_logfile(e);
+
+    return got;
+}
+
+/*
+ * start tailing any files matching the pattern that we don't tail
+ * yet.  files turning up after the initial scan are new, so they are
+ * shown from the start.
+ */
+void scan_glob(struct glob_source *g, int initial)
+{
+    glob_t gl;
+    size_t i;
+
+    g->rescan = 0;
+
+#if HAS_EPOLL
+    /* watch the directory above the first wildcard, and every directory
+     * matching the pattern up to each later '/', so that new matches
+     * and new directories with matches in them are both noticed */
+    if (inotify_fd >= 0) {
+        const char *wild = strpbrk(g->pattern, "*?[");
+        const char *slash = wild ? wild : g->pattern + strlen(g->pattern);
+        char *dir = xstrdup(g->pattern);
+
+        while (slash > g->pattern && *slash != '/')
+            slash--;
+
+        if (*slash != '/')
+            watch_dirs(g, ".");
+        else if (slash == g->pattern)
+            watch_dirs(g, "/");
+
+        for (; slash; slash = strchr(slash + 1, '/')) {
+            if (slash == g->pattern)
+                continue;
+            dir[slash - g->pattern] = '\0';
+            watch_dirs(g, dir);
+            dir[slash - g->pattern] = '/';
+        }
+
+        free(dir);
+    }
+#endif
+
+    if (glob(g->pattern, GLOB_MARK, NULL, &gl) != 0)
+        return;
+
+    for (i = 0; i < gl.gl_pathc; i++) {
+        const char *fname = gl.gl_pathv[i];
+
+        /* GLOB_MARK puts a '/' after directories */
+        if (fname[strlen(fname) - 1] != '/' && !find_file(fname))
+            add_match(g, fname, initial);
+    }
+
+    globfree(&gl);
+}
+
+/*
+ * checksum the first LEN bytes of a file (fewer if it is shorter), and
+ * return how many that were
+ */
+static int fingerprint(int fd, int len, unsigned int *sum)
+{
+    unsigned char buf[FINGERPRINT_SIZE];
+    int n = pread(fd, buf, len, 0), i;
+
+    *sum = 2166136261u;
+    for (i = 0; i < n; i++)
+        *sum = (*sum ^ buf[i]) * 16777619u;
+
+    return n < 0 ? 0 : n;
+}
+
+/* is the file just opened the one we had open before? */
+static int same_file(struct logfile_entry *file, struct stat *stats)
+{
+    unsigned int sum;
+
+    return file->inode && stats->st_ino == file->inode
+           && stats->st_dev == file->dev && file->offset <= stats->st_size
+           && fingerprint(fileno(file->fp), file->fingerprint_len, &sum)
+                  == file->fingerprint_len
+           && sum == file->fingerprint;
+}
+
+/* the file may have been too short for a good fingerprint when it was
+ * opened, or have been truncated since */
+static void refresh_fingerprint(struct logfile_entry *file)
+{
+    if (file->fingerprint_len < FINGERPRINT_SIZE)
+        file->fingerprint_len = fingerprint(fileno(file->fp), FINGERPRINT_SIZE,
+                                            &file->fingerprint);
+}
+
+/* close a file, remembering how far we got for openlog () */
+static void close_log(struct logfile_entry *file)
+{
+    if (!file->fp)
+        return;
+
+    file->offset = ftell(file->fp);
+    refresh_fingerprint(file);
+    fclose(file->fp);
+    file->fp = NULL;
+
+#if HAS_EPOLL
+    /* the watch is on the inode we just let go of, which may never
+     * change again; until the name is back, only polling will tell */
+    unwatch_file(file);
+#endif
+    poll_unwatched(file);
+}
+
+/* input: reads file->fname
+ * output: fills file->fp, file->inode
+ * returns file->fp
+ * in case of error, file->fp is NULL
+ */
+FILE *openlog(struct logfile_entry *file)
+{
+    struct stat stats;
+
+    if ((file->fp = fopen(file->fname, "r")) == NULL) {
+        file->fp = NULL;
+        return NULL;
+    }
+
+    /* the first time, we may know where we got to from -state */
+    if (!file->inode)
+        saved_position(file);
+
+    fstat(fileno(file->fp), &stats);
+
+    if (!S_ISFIFO(stats.st_mode) && same_file(file, &stats))
+        /* reopened, but not replaced: carry on where we were rather
+         * than showing the end of it again */
+        fseek(file->fp, file->offset, SEEK_SET);
+    else if (opt_noinitial)
+        fseek(file->fp, 0, SEEK_END);
+    else /* if (stats.st_size > (listlen + 1) * width)
+          * HACK - 'width' is in pixels - how are we to know how much text will
+          * fit? fseek (file->fp, -((listlen + 2) * width/10), SEEK_END); */
+        fseek(file->fp, -5000, SEEK_END);
+
+    if (S_ISFIFO(stats.st_mode)) {
+        if (fcntl(fileno(file->fp), F_SETFL, O_NONBLOCK) < 0)
+            perror("fcntl"), exit(1);
+        file->inode = 0;
+    } else {
+        file->inode = stats.st_ino;
+        file->dev = stats.st_dev;
+        file->fingerprint_len = fingerprint(fileno(file->fp), FINGERPRINT_SIZE,
+                                            &file->fingerprint);
+    }
+
+    file->last_size = stats.st_size;
+    mark_ready(file);
+
+#if HAS_EPOLL
+    /* the watch follows the inode, so it has to be renewed whenever
+     * the file is opened again */
+    if (inotify_fd >= 0 && file->inode)
+        watch_file(file);
+#endif
+    poll_unwatched(file);
+
+    return file->fp;
+}
+
+void reopen(void)
+{
+    struct logfile_entry *e;
+
+    for (e = loglist; e; e = e->next) {
+        if (!e->inode)
+            continue; /* skip stdin */
+
+        close_log(e);
+        /* if fp is NULL we will try again later */
+        openlog(e);
+    }
+
+    do_reopen = 0;
+}
+
+/*
+ * look for a file having been rotated or truncated.  returns true if
+ * it was a match for a pattern that has gone, and had lines left to
+ * show.
+ */
+int check_open_file(struct logfile_entry *e)
+{
+    struct stat stats;
+
+    if (!e->inode)
+        return 0; /* skip stdin */
+
+    if (stat(e->fname, &stats) < 0) { /* file missing? */
+        /* a new file by that name would be a new match */
+        if (e->glob)
+            return drop_match(e);
+
+        /* it may already be back; if not, the next poll retries */
+        close_log(e);
+        if (openlog(e) == NULL)
+            return 0;
+        if (fstat(fileno(e->fp), &stats) < 0)
+            return 0;
+    }
+
+    if (!e->fp || stats.st_ino != e->inode) { /* renamed, or not open? */
+        close_log(e);
+        if (openlog(e) == NULL)
+            return 0;
+        if (fstat(fileno(e->fp), &stats) < 0)
+            return 0;
+    }
+
+    if (stats.st_size < e->last_size) { /* file truncated? */
+        fseek(e->fp, 0, SEEK_SET);
+        e->fingerprint_len = 0; /* taken again when it's closed */
+        mark_ready(e);
+    }
+
+    e->last_size = stats.st_size;
+    return 0;
+}
+
+/* returns true if anything new has to be displayed */
+int check_open_files(void)
+{
+    struct logfile_entry *e;
+    int got = 0;
+
+    TRACE_BEGIN("check_open_files");
+
+    while ((e = recheck_head)) {
+        if (!(recheck_head = e->recheck_next))
+            recheck_tail = NULL;
+        e->recheck = 0;
+
+        if (check_open_file(e))
+            got = 1;
+    }
+
+    TRACE_END();
+
+    return got;
+}
+
+/*
+ * insert a single node in the list of screen lines and return a
+ * pointer to the new node.
+ * the caller MUST then fill in ret->line and ret->len with valid
+ * data.
+ */
+static struct line_node *new_line_node(struct logfile_entry *log)
+{
+    struct line_node *new = xmalloc(sizeof(struct line_node));
+
+    new->logfile = log;
+    new->wrapped_left = 0;
+    new->wrapped_right = 0;
+    new->breaks = 0;
+    new->breaks_size = 0;
+    new->words = 0;
+    new->measured = 0;
+    new->spaces = 0;
+    new->break_index = -1;
+
+    assert(log);
+
+    if (!log || !log->last) {
+        new->next = linelist;
+        new->next->prev = new;
+
+        new->prev = NULL;
+        linelist = new;
+    } else {
+        /* 2 pointers from the new node */
+        new->next = log->last;
+        new->prev = log->last->prev;
+
+        /* 2 pointers back to the new node */
+        if (new->next)
+            new->next->prev = new;
+        if (new->prev)
+            new->prev->next = new;
+
+        /* if this is a new first entry in the list then update
+         * 'linelist' */
+        if (log->last == linelist)
+            linelist = new;
+    }
+
+    /* update the logfile record */
+    if (log)
+        log->last = new;
+
+    return new;
+}
+
+/*
+ * a 64 bit FNV-1a hash of what a row looks like (its text, and whether
+ * it starts with the continuation string), so -noflicker can tell
+ * whether it changed without keeping a copy of what it drew
+ */
+static void hash_row(struct line_node *line)
+{
+    unsigned long long h = 14695981039346656037ULL;
+    const unsigned char *p = (const unsigned char *)line->line;
+    const unsigned char *end = p + line->len;
+
+    h = (h ^ line->wrapped_left) * 1099511628211ULL;
+    while (p < end)
+        h = (h ^ *p++) * 1099511628211ULL;
+
+    line->hash = h;
+}
+
+/*
+ * record a place where the line could be broken, for -justify
+ */
+static void add_break(struct line_node *line, int index)
+{
+    if (line->spaces >= line->breaks_size) {
+        if (!line->breaks_size) {
+            line->breaks_size = 32;
+            line->breaks
+                = xmalloc(line->breaks_size * sizeof(struct breakinfo));
+            line->breaks[0].index = 0;
+        } else {
+            line->breaks_size *= 1.5;
+            line->breaks = xrealloc(
+                line->breaks, line->breaks_size * sizeof(struct breakinfo));
+        }
+    }
+
+    /* store information about (a) the location of each space */
+    line->breaks[line->spaces].index = index;
+    /* (b) the length of each 'word' */
+    line->breaks[line->spaces - 1].len
+        = index - line->breaks[line->spaces - 1].index;
+}
+
+/*
+ * the length in bytes of the character at P, of which L bytes are
+ * there, like mblen (): 0 for '\0', -1 for an illegal or incomplete
+ * sequence.  UTF-8 is decoded here, without the C library's state.
+ */
+static int char_len(const char *p, int l)
+{
+    const unsigned char *s = (const unsigned char *)p;
+    int len, i;
+
+    if (!utf8_locale)
+        return mblen(p, l);
+
+    if (s[0] < 0x80)
+        return s[0] != 0;
+    else if (s[0] < 0xc2)
+        return -1; /* a continuation byte, or an overlong sequence */
+    else if (s[0] < 0xe0)
+        len = 2;
+    else if (s[0] < 0xf0)
+        len = 3;
+    else if (s[0] < 0xf5)
+        len = 4;
+    else
+        return -1;
+
+    if (len > l)
+        return -1;
+
+    for (i = 1; i < len; i++)
+        if ((s[i] & 0xc0) != 0x80)
+            return -1;
+
+    /* overlong, surrogates, or beyond U+10FFFF */
+    if ((s[0] == 0xe0 && s[1] < 0xa0) || (s[0] == 0xed && s[1] > 0x9f)
+        || (s[0] == 0xf0 && s[1] < 0x90) || (s[0] == 0xf4 && s[1] > 0x8f))
+        return -1;
+
+    return len;
+}
+
+/*
+ * how many of the L bytes at P are ASCII, before the first that isn't.
+ * they are looked at 16 (or a word's worth) at a time.
+ */
+static int ascii_run(const char *p, int l)
+{
+    int n = 0;
+
+#if HAS_SSE2
+    while (n + 16 <= l) {
+        int mask = _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(p + n)));
+
+        if (mask)
+            return n + __builtin_ctz(mask);
+        n += 16;
+    }
+#endif
+
+    while (n + (int)sizeof(unsigned long) <= l) {
+        unsigned long w;
+
+        memcpy(&w, p + n, sizeof w);
+        if (w & (~0UL / 0xff * 0x80))
+            break;
+        n += sizeof w;
+    }
+
+    while (n < l && !(p[n] & 0x80))
+        n++;
+
+    return n;
+}
+
+/*
+ * how many of the L bytes at P are printable ASCII (' ' to '~'), before
+ * the first that isn't
+ */
+static int printable_run(const char *p, int l)
+{
+    int n = 0;
+
+#if HAS_SSE2
+    const __m128i lo = _mm_set1_epi8(' ' - 1), hi = _mm_set1_epi8('~' + 1);
+
+    while (n + 16 <= l) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + n));
+        int mask = _mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpgt_epi8(v, lo), _mm_cmplt_epi8(v, hi)));
+
+        if (mask != 0xffff)
+            return n + __builtin_ctz(~mask);
+        n += 16;
+    }
 #endif
+
+    while (n < l && (unsigned char)p[n] >= ' ' && (unsigned char)p[n] <= '~')
+        n++;
+
+    return n;
+}
+
+/*
+ * lay out a row that -justify spreads over the whole width, once: every
+ * word becomes an item for XmbDrawText (), which moves it FREE_PIXELS *
+ * i / (words - 1) pixels to the right of where it would be otherwise
+ */
+static void justify_row(struct line_node *line, int free_pixels)
+{
+    int n = line->spaces + 1, i, shift = 0;
+
+    line->words = xmalloc(n * sizeof(XmbTextItem));
+    line->num_words = n;
+
+    for (i = 0; i < n; i++) {
+        XmbTextItem *word = line->words + i;
+
+        word->chars = line->line + line->breaks[i].index;
+        word->nchars = line->breaks[i].len;
+        word->delta = (i * free_pixels) / (n - 1) - shift;
+        word->font_set = i ? None : line->logfile->fontset;
+        shift += word->delta;
     }
+}
 
-    /* at least one of the lines must fit in the allocated area.  we've
-     * already checked at initialisation time that all the fonts are small
-     * enough to fit at least one line in the display area, but assert it
-     * again here to be sure */
-    assert(line != linelist);
+/*
+ * measure the characters at the start of the L bytes at P into
+ * char_extents, with a single call.  no more are measured than fit in
+ * a row (at a pixel each), so a huge line doesn't make the arrays
+ * huge.  returns the number of characters, or 0 if Xlib doesn't see the
+ * same characters in the text as char_len () does (because it isn't
+ * valid in this locale, or ends in the middle of a character).
+ */
+static int measure_chars(XFontSet fontset, const char *p, int l)
+{
+    XRectangle ink, logical;
+    int count = 0, n, i, len, max = width - effect_x_space;
 
-    /* any lines that didn't just get looked at are never going to be, so break
-     * the chain */
-    if (line)
-        line->prev->next = 0;
+    for (i = 0; i < l && (count < max || !count); i += len) {
+        if ((len = char_len(p + i, l - i)) <= 0)
+            return 0;
+        count++;
+    }
 
-    /* and throw them all away */
-    while (line) {
-        struct line_node *this = line;
-        line = line->next;
-        if (this->logfile && this->logfile->last == this)
-            this->logfile->last = NULL;
-        free(this->line);
-        free(this->breaks);
-        free(this);
+    if (count > char_extents_size) {
+        char_extents_size = count + count / 2;
+        char_ink = xrealloc(char_ink, char_extents_size * sizeof(XRectangle));
+        char_extents
+            = xrealloc(char_extents, char_extents_size * sizeof(XRectangle));
+    }
+
+    stats.escapements++;
+    if (!XmbTextPerCharExtents(fontset, p, i, char_ink, char_extents,
+                               char_extents_size, &n, &ink, &logical)
+        || n != count)
+        return 0;
+
+    return n;
+}
+
+/*
+ * cut LINE, the last row -maxrows allows for a line, short, so that it
+ * fits with TRUNCATE_MARK at its end.  the rest of the text is dropped.
+ * K is the row's first character in char_extents, which holds COUNT
+ * characters, or -1 if it isn't there; only what comes after those is
+ * measured.
+ */
+static void cut_row(struct line_node *line, struct logfile_entry *log, int k,
+                    int count)
+{
+    int avail = width - effect_x_space - truncate_width;
+    int w = line->wrapped_left ? continuation_width : 0;
+    int l = line->len, len, n, batch = 1;
+    char *p = line->line;
+
+    while (l > 0) {
+        int cw;
+
+        /* ASCII in a fixed width font is counted, not measured */
+        n = log->char_width ? printable_run(p, l) : 0;
+        if (n > 0) {
+            int fit = avail > w ? (avail - w) / log->char_width : 0;
+
+            if (n > fit) {
+                w += fit * log->char_width;
+                p += fit;
+                break;
+            }
+            w += n * log->char_width;
+            p += n;
+            l -= n;
+            if (k >= 0)
+                k += n;
+            continue;
+        }
+
+        len = char_len(p, l);
+        if (len <= 0)
+            len = 1;
+
+        if (batch && (k < 0 || k >= count)) {
+            count = measure_chars(log->fontset, p, l);
+            batch = count > 0;
+            k = batch ? 0 : -1;
+        }
+
+        if (k >= 0)
+            cw = char_extents[k].width;
+        else {
+            cw = XmbTextEscapement(log->fontset, p, len);
+            stats.escapements++;
+        }
+        if (w + cw > avail)
+            break;
+
+        w += cw;
+        p += len;
+        l -= len;
+        if (k >= 0)
+            k++;
+    }
+
+    len = p - line->line;
+    line->line = xrealloc(line->line, len + sizeof TRUNCATE_MARK);
+    memcpy(line->line + len, TRUNCATE_MARK, sizeof TRUNCATE_MARK);
+    line->len = line->measured = len + sizeof TRUNCATE_MARK - 1;
+    line->width = w + truncate_width;
+    line->spaces = 0;
+    line->break_index = -1;
+
+    log->rows_cut = 1;
+}
+
+/*
+ * this is called after either adding a new line or appending to an
+ * old one.  in both cases it's possible that the line no longer fits,
+ * and needs wrapping.  this function checks the last line associated
+ * with the supplied logfile.
+ *
+ * the last line remembers how much of it has been measured already
+ * (and where it could be broken), so appending to it only measures
+ * the new text.  that text is measured a row's worth at a time, unless
+ * it's ASCII in a fixed width font, which doesn't have to be measured.
+ */
+static void possibly_split_long_line(struct logfile_entry *log)
+{
+    struct line_node *line = log->last;
+    int k = -1;     /* the character at p in char_extents, -1 if not there */
+    int count = 0;  /* how many characters char_extents holds */
+    int batch = 1;  /* false if measure_chars () couldn't do it */
+
+    TRACE_BEGIN("possibly_split_long_line");
+
+    /* only calculate the continuation's width once */
+    if (continuation_width == -1) {
+        continuation_length = strlen(continuation);
+        continuation_width = XmbTextEscapement(log->fontset, continuation,
+                                               continuation_length);
+        stats.escapements++;
+        continuation_color = GetColor(cont_color);
+        truncate_width = XmbTextEscapement(log->fontset, TRUNCATE_MARK,
+                                           sizeof TRUNCATE_MARK - 1);
+        stats.escapements++;
+    }
+
+    for (;;) {
+        char *beg = line->line;
+        char *p = beg + line->measured;
+        int l = line->len - line->measured;
+        int start_w = line->wrapped_left ? continuation_width : 0;
+        int w = line->measured ? line->width : start_w;
+        int wrapped = 0, incomplete = 0;
+        char *break_p = line->break_index >= 0 ? beg + line->break_index : NULL;
+        char *tail;
+        int prefix_len;
+        struct breakinfo *spare = NULL;
+        int spare_size = 0;
+        int ascii = 0; /* bytes ahead that are known to be ASCII */
+        int break_k = -1; /* the character at break_p in char_extents */
+        int row_k = p == beg ? k : -1; /* and the one at beg */
+
+        while (*p) {
+            int cw, len, n;
+
+            /* with a fixed width font, as much printable ASCII as fits
+             * is measured in one go, and only its spaces are looked at */
+            n = 0;
+            if (log->char_width) {
+                n = printable_run(p, l);
+                if (n > (width - effect_x_space - w) / log->char_width)
+                    n = (width - effect_x_space - w) / log->char_width;
+            }
+
+            if (n > 0) {
+                char *q = p, *end = p + n;
+
+                while (opt_wordwrap && (q = memchr(q, ' ', end - q))) {
+                    if (q != break_p + 1) {
+                        break_p = q;
+                        break_k = k >= 0 ? k + (q - p) : -1;
+                        line->break_width = w + (q - p) * log->char_width;
+                        line->spaces++;
+
+                        if (opt_justify)
+                            add_break(line, q + 1 - beg);
+                    }
+                    q++;
+                }
+
+                w += n * log->char_width;
+                p += n;
+                l -= n;
+                if (k >= 0)
+                    k += n;
+                ascii = 0;
+                continue;
+            }
+
+            /* find the length in bytes of the next multibyte character;
+             * with UTF-8, runs of ASCII are found in one go */
+            if (!ascii && utf8_locale)
+                ascii = ascii_run(p, l);
+            if (ascii) {
+                len = 1;
+                ascii--;
+            } else if ((len = char_len(p, l)) <= 0) {
+                /* this might be the start of a character we haven't
+                 * seen the rest of yet */
+                if (l < MB_CUR_MAX)
+                    incomplete = 1;
+                len = 1; /* ignore (don't skip) illegal character sequences */
+            }
+
+            /* find the width in pixels of the next character.  the
+             * characters are measured a row's worth at a time, when one
+             * that isn't measured yet is needed */
+            if (batch && (k < 0 || k >= count)
+                && !(log->char_width && *p >= ' ' && *p <= '~')) {
+                count = measure_chars(log->fontset, p, l);
+                batch = count > 0;
+                k = batch ? 0 : -1;
+                break_k = -1;
+                row_k = p == beg ? k : -1;
+            }
+
+            if (k >= 0)
+                cw = char_extents[k].width;
+            else if (log->char_width && *p >= ' ' && *p <= '~')
+                cw = log->char_width;
+            else {
+                cw = XmbTextEscapement(log->fontset, p, len);
+                stats.escapements++;
+            }
+
+            if (opt_wordwrap && len == 1 && p[0] == ' ' && p != break_p + 1) {
+                break_p = p;
+                break_k = k;
+                line->break_width = w;
+                line->spaces++;
+
+                if (opt_justify)
+                    add_break(line, p + 1 - beg);
+            }
+
+            if (cw + w > width - effect_x_space) {
+                if (p == beg) {
+                    fprintf(
+                        stderr,
+                        "we can't even fit a single character onto the line\n");
+                    if (len == 1)
+                        fprintf(stderr,
+                                "(the character we couldn't fit was '%c')\n",
+                                *p);
+                    exit(1);
+                }
+
+                wrapped = 1;
+                break;
+            }
+
+            w += cw;
+            p += len;
+            l -= len;
+            if (k >= 0)
+                k++;
+        }
+
+        if (!wrapped) {
+            /* remember how far we got for the next append, unless the
+             * line ends in the middle of a character */
+            if (incomplete) {
+                line->measured = line->spaces = 0;
+                line->break_index = -1;
+            } else {
+                line->measured = p - beg;
+                line->width = w;
+                line->break_index = break_p ? break_p - beg : -1;
+            }
+            break;
+        }
+
+        /* the line has all the rows -maxrows gives it */
+        if (max_rows && log->rows >= max_rows) {
+            cut_row(line, log, row_k, count);
+            break;
+        }
+
+        /* if we're wrapping at spaces, and the line is long enough to
+         * wrap, and we've seen a space already, and the space wasn't
+         * the first character on the line, then wrap at the space */
+        if (opt_wordwrap && break_p && break_p != beg) {
+            prefix_len = break_p - beg;
+            p = break_p;
+            w = line->break_width;
+            k = break_k;
+
+            /* if breaking at a space, skip all adjacent spaces */
+            while (*p == ' ') {
+                int len = char_len(p, l);
+                if (len != 1)
+                    break;
+                p++;
+                if (k >= 0)
+                    k++;
+            }
+
+            if (opt_justify) {
+                line->spaces--;
+                line->breaks[line->spaces].len--;
+            }
+        } else {
+            prefix_len = p - beg;
+
+            if (opt_justify && line->spaces)
+                line->breaks[line->spaces].len
+                    = prefix_len - line->breaks[line->spaces].index;
+        }
+
+        /* make a copy of the tail end of the string */
+        tail = xstrdup(p);
+
+        /* and reduce the size of the head of the string */
+        line->line = xrealloc(line->line, prefix_len + 1);
+        line->len = line->measured = prefix_len;
+        line->line[prefix_len] = '\0';
+
+        /* note that the head was wrapped on it's right */
+        line->wrapped_right = 1;
+        hash_row(line);
+
+        /* 'spaces' includes any space we broke on; we can only justify
+         * if there's at least one other space */
+        if (opt_justify && line->spaces
+            && width - effect_x_space - line->break_width
+                   < line->spaces * log->font_height)
+            justify_row(line, width - effect_x_space - w);
+
+        /* the breaks aren't needed any more; hand the array on to the
+         * tail */
+        spare = line->breaks;
+        spare_size = line->breaks_size;
+        line->breaks = 0;
+        line->breaks_size = 0;
+
+        line = new_line_node(log);
+        line->line = tail;
+        line->len = strlen(tail);
+        log->rows++;
+
+        if (spare) {
+            line->breaks = spare;
+            line->breaks_size = spare_size;
+            line->breaks[0].index = 0;
+        }
+
+        /* note that the tail end of the string is wrapped at its left */
+        line->wrapped_left = 1;
+
+        if (!line->len)
+            break;
+    }
+
+    hash_row(line);
+    TRACE_END();
+}
+
+static void insert_new_line(char *str, struct logfile_entry *log,
+                            int wrapped_left)
+{
+    struct line_node *new;
+    new = new_line_node(log);
+    new->line = str;
+    new->len = strlen(str);
+    new->wrapped_left = wrapped_left;
+
+    if (wrapped_left)
+        log->rows++;
+    else {
+        log->rows = 1;
+        log->rows_cut = 0;
+    }
+
+    possibly_split_long_line(log);
+}
+
+/*
+ * insert the "[desc]" line for a file.  the header is measured only
+ * once, and as long as it fits it is inserted as a single node
+ * without being split again.
+ */
+static void insert_header_line(struct logfile_entry *log)
+{
+    struct line_node *new;
+
+    if (log->header_width < 0) {
+        log->header_width
+            = XmbTextEscapement(log->fontset, log->header, log->header_len);
+        stats.escapements++;
+    }
+
+    if (log->header_width > width - effect_x_space) {
+        insert_new_line(xstrdup(log->header), log, 0);
+        return;
+    }
+
+    new = new_line_node(log);
+    new->line = xmalloc(log->header_len + 1);
+    memcpy(new->line, log->header, log->header_len + 1);
+    new->len = new->measured = log->header_len;
+    new->width = log->header_width;
+    hash_row(new);
+}
+
+/*
+ * append something to an existing physical line. this is done
+ * by deleting the file on-screen, concatenating the new data to it
+ * and splitting it again.
+ */
+static void append_to_existing_line(char *str, struct logfile_entry *log)
+{
+    char *old, *new;
+
+    assert(log);
+    assert(log->last);
+
+    old = log->last->line;
+    assert(old);
+
+    new = concat_line(old, str);
+    free(str);
+    log->last->line = new;
+    log->last->len = strlen(new);
+    possibly_split_long_line(log);
+}
+
+/*
+ * fill the screen with '~' lines and allocate the matching record of
+ * what has been displayed
+ */
+static void init_linelist(void)
+{
+    int lin;
+
+    display = xmalloc(sizeof(struct displaymatrix) * listlen);
+
+    for (lin = 0; lin < listlen; lin++) {
+        struct line_node *e = xmalloc(sizeof(struct line_node));
+        e->line = xstrdup("~");
+        e->len = 1;
+        /* this is only needed to get a color for the '~' */
+        e->logfile = loglist ? loglist : &globlist->proto;
+        e->wrapped_left = 0;
+        e->wrapped_right = 0;
+        e->breaks = 0;
+        e->breaks_size = 0;
+        e->words = 0;
+        e->measured = 0;
+        e->spaces = 0;
+        e->break_index = -1;
+        e->next = NULL;
+        e->prev = linelist_tail;
+
+        if (!linelist)
+            linelist = e;
+        if (linelist_tail)
+            linelist_tail->next = e;
+        linelist_tail = e;
+        hash_row(e);
+    }
+
+    memset(display, 0, sizeof(struct displaymatrix) * listlen);
+}
+
+/*
+ * -state: how far every file was read, and the lines on the screen, so
+ * that a restart carries on where the last run left off.  the state is
+ * a text file of
+ *
+ *   root-tail-state 1
+ *   file DEV INODE OFFSET FINGERPRINT_LEN FINGERPRINT NAME
+ *   line FILE WRAPPED_LEFT TEXT
+ *
+ * with the lines oldest first, and FILE the index of the file line.
+ */
+struct saved_file {
+    char *name;
+    dev_t dev;
+    ino_t inode;
+    off_t offset;
+    unsigned int fingerprint;
+    int fingerprint_len;
+    int hash_next; /* 1 + index of the next in the same hash chain, or 0 */
+};
+
+struct saved_line {
+    int file;
+    int wrapped_left;
+    char *text;
+};
+
+static struct saved_file *saved_files;
+static int saved_files_count;
+static int saved_hash[FILE_HASH_SIZE]; /* 1 + index of a chain's first */
+static struct saved_line *saved_lines;
+static int saved_lines_count;
+
+static void load_state(void)
+{
+    FILE *f = fopen(state_file, "r");
+    char *buf = NULL;
+    size_t size = 0;
+    ssize_t len;
+    int files_size = 0, lines_size = 0;
+
+    if (!f)
+        return; /* nothing saved yet */
+
+    if ((len = getline(&buf, &size, f)) < 0
+        || strcmp(buf, "root-tail-state 1\n")) {
+        fprintf(stderr, "%s: not a root-tail state file, ignored\n",
+                state_file);
+        fclose(f);
+        free(buf);
+        return;
     }
 
-    if (opt_frame) {
-        XSetForeground(disp, WinGC, GetColor(def_color));
-        /* note that XDrawRectangle() draws a rectangle one pixel bigger
-         * in both dimensions than you ask for, hence the subtractions.
-         * XFillRectangle() doesn't suffer from this problem */
-        XDrawRectangle(disp, root, WinGC, win_x - 0, win_y - 0, width - 1,
-                       height - 1);
+    while ((len = getline(&buf, &size, f)) > 0) {
+        unsigned long long dev, inode, offset;
+        unsigned int sum;
+        int n, fplen, file, wrapped;
+
+        if (buf[len - 1] == '\n')
+            buf[--len] = '\0';
+
+        /* the name and the text follow a single space, and may start
+         * with spaces of their own */
+        if (sscanf(buf, "file %llu %llu %llu %d %u%n", &dev, &inode, &offset,
+                   &fplen, &sum, &n)
+                == 5
+            && (buf[n] == ' ' || !buf[n])) {
+            struct saved_file *sf;
+
+            if (saved_files_count == files_size) {
+                files_size = files_size * 2 + 16;
+                saved_files = xrealloc(saved_files,
+                                       files_size * sizeof(struct saved_file));
+            }
+
+            sf = saved_files + saved_files_count++;
+            sf->name = xstrdup(buf + n + (buf[n] == ' '));
+            sf->hash_next = saved_hash[hash_name(sf->name)];
+            saved_hash[hash_name(sf->name)] = saved_files_count;
+            sf->dev = dev;
+            sf->inode = inode;
+            sf->offset = offset;
+            sf->fingerprint_len = fplen;
+            sf->fingerprint = sum;
+        } else if (sscanf(buf, "line %d %d%n", &file, &wrapped, &n) == 2
+                   && (buf[n] == ' ' || !buf[n]) && file >= 0
+                   && file < saved_files_count) {
+            struct saved_line *sl;
+
+            if (saved_lines_count == lines_size) {
+                lines_size = lines_size * 2 + 16;
+                saved_lines = xrealloc(saved_lines,
+                                       lines_size * sizeof(struct saved_line));
+            }
+
+            sl = saved_lines + saved_lines_count++;
+            sl->file = file;
+            sl->wrapped_left = wrapped;
+            sl->text = xstrdup(buf + n + (buf[n] == ' '));
+        }
     }
+
+    free(buf);
+    fclose(f);
 }
 
-#if HAS_REGEX
-void transform_line(char *s)
+/* start from where the last run got to in a file, if we know */
+static void saved_position(struct logfile_entry *e)
 {
-#ifdef I_AM_Md
+    struct saved_file *sf;
     int i;
-    if (1) {
-        for (i = 16; s[i]; i++)
-            s[i] = s[i + 11];
-    }
-    s[i + 1] = '\0';
-#endif
 
-    if (transformre) {
-        int i;
-        regmatch_t matched[16];
+    if (!saved_files_count)
+        return;
 
-        i = regexec(transformre, s, 16, matched, 0);
-        if (i == 0) { /* matched */
-            int match_start = matched[0].rm_so;
-            int match_end = matched[0].rm_eo;
-            int old_len = match_end - match_start;
-            int new_len = strlen(transform_to);
-            int old_whole_len = strlen(s);
+    for (i = saved_hash[hash_name(e->fname)]; i; i = sf->hash_next) {
+        sf = saved_files + i - 1;
 
-            printf("regexp was matched by '%s' - replace with '%s'\n", s,
-                   transform_to);
-            printf("match is from %d to %d\n", match_start, match_end);
-            if (new_len > old_len)
-                s = xrealloc(s, old_whole_len + new_len - old_len);
+        if (sf->inode && !strcmp(sf->name, e->fname)) {
+            e->dev = sf->dev;
+            e->inode = sf->inode;
+            e->offset = sf->offset;
+            e->fingerprint = sf->fingerprint;
+            e->fingerprint_len = sf->fingerprint_len;
+            return;
+        }
+    }
+}
 
-            if (new_len != old_len) {
-                memcpy(s + match_end + new_len - old_len, s + match_end,
-                       old_whole_len - match_end);
-                s[old_whole_len + new_len - old_len] = '\0';
-            }
+/* put the saved lines back on the screen */
+static void restore_lines(void)
+{
+    struct logfile_entry *e;
+    int i;
 
-            memcpy(s + match_start, transform_to, new_len);
-            printf("transformed to '%s'\n", s);
-        } else
-            printf("regexp was not matched by '%s'\n", s);
+    for (i = 0; i < saved_lines_count; i++) {
+        struct saved_line *sl = saved_lines + i;
+        const char *name = saved_files[sl->file].name;
+
+        if (!(e = *name ? find_file(name) : NULL)) {
+            free(sl->text); /* not shown any more */
+            continue;
+        }
+
+        if (!sl->wrapped_left)
+            e->last = NULL;
+        insert_new_line(sl->text, e, sl->wrapped_left);
+        lastprinted = e;
     }
+
+    /* new lines start new screen lines */
+    for (e = loglist; e; e = e->next)
+        e->last = NULL;
+
+    for (i = 0; i < saved_files_count; i++)
+        free(saved_files[i].name);
+    free(saved_files);
+    free(saved_lines);
+    saved_files = NULL;
+    saved_lines = NULL;
+    saved_files_count = saved_lines_count = 0;
+    memset(saved_hash, 0, sizeof saved_hash);
 }
-#endif
 
 /*
- * appends p2 to the end of p1, if p1 is not null
- * otherwise allocates a new string and copies p2 to it
+ * write the state to a new file and rename it over the old one, so
+ * that there always is a complete state file
  */
-char *concat_line(char *p1, const char *p2)
+static void save_state(void)
 {
-    int l1 = p1 ? strlen(p1) : 0;
-    int l2 = strlen(p2);
-    char *r;
+    struct logfile_entry *e;
+    struct line_node *line;
+    char *tmp = xmalloc(strlen(state_file) + 5);
+    FILE *f;
+    int i, n = 0;
 
-    assert(p2);
+    state_redraws = stats.redraws;
 
-    if (p1)
-        r = xrealloc(p1, l1 + l2 + 1);
-    else
-        r = xmalloc(l2 + 1);
+    sprintf(tmp, "%s.tmp", state_file);
+    if (!(f = fopen(tmp, "w"))) {
+        perror(tmp);
+        free(tmp);
+        return;
+    }
 
-    memcpy(r + l1, p2, l2);
-    r[l1 + l2] = 0;
+    fprintf(f, "root-tail-state 1\n");
 
-    return r;
+    for (e = loglist; e; e = e->next) {
+        off_t offset = 0;
+
+        if (e->fp && e->inode) {
+            /* not counting what's been read of a line not shown yet */
+            offset = ftell(e->fp) - e->pending_bytes;
+            refresh_fingerprint(e);
+        }
+
+        fprintf(f, "file %llu %llu %llu %d %u %s\n",
+                (unsigned long long)(e->fp ? e->dev : 0),
+                (unsigned long long)(e->fp ? e->inode : 0),
+                (unsigned long long)offset, e->fingerprint_len, e->fingerprint,
+                e->fname ? e->fname : "");
+        e->state_index = n++;
+    }
+
+    /* the lines on the screen, oldest first */
+    for (line = linelist, i = 0; line->next && i < listlen - 1; i++)
+        line = line->next;
+
+    for (; line; line = line->prev)
+        if (line->logfile && line->logfile->state_index >= 0)
+            fprintf(f, "line %d %d %s\n", line->logfile->state_index,
+                    line->wrapped_left, line->line);
+
+    if (fflush(f) || fsync(fileno(f)) < 0 || fclose(f)
+        || rename(tmp, state_file) < 0)
+        perror(state_file);
+
+    free(tmp);
 }
 
 /*
- * This routine can read a line of any length if it is called enough times.
+ * put the line just read from a file (in current->buf) on the screen
  */
-int lineinput(struct logfile_entry *logfile)
+static void display_buf(struct logfile_entry *current)
 {
-    char buff[1024], *p;
-    int ch;
-    /* HACK-2: add on the length of any partial line which we will be appending
-     * to */
-    int ofs = logfile->buf ? strlen(logfile->buf) : 0;
+    stats_line_read();
 
-    /* this loop ensures that the whole line is read, even if it's
-     * longer than the buffer.  we need to do this because when --whole
-     * is in effect we don't know whether to display the line or not
-     * until we've seen how (ie. whether) it ends */
-    do {
-        p = buff;
-        do {
-            ch = fgetc(logfile->fp);
+    /* the rest of a line that -maxrows cut short isn't shown */
+    if (!opt_whole && current->lastpartial && current->rows_cut) {
+        free(current->buf);
+        current->buf = 0;
+        return;
+    }
 
-            if (ch == '\n' || ch == EOF)
-                break;
-            else if (ch == '\r')
-                continue; /* skip */
-            else if (ch == '\t') {
-                do {
-                    *p++ = ' ';
-                    ofs++;
-                } while (ofs & 7);
-            } else {
-                *p++ = ch;
-                ofs++;
-            }
-        } while (p < buff + (sizeof buff) - 8 - 1);
+    /* if we're trying to update old partial lines in
+     * place, and the last time this file was updated the
+     * output was partial, and that partial line is not
+     * too close to the top of the screen, then update
+     * that partial line */
+    if (opt_update && current->lastpartial && current->last) {
+        append_to_existing_line(current->buf, current);
+        current->buf = 0;
+        return;
+    }
 
-        if (p == buff && ch == EOF)
-            return 0;
+    /* if all we just read was a newline ending a line that we've
+     * already displayed, skip it */
+    if (current->buf[0] == '\0' && current->lastpartial) {
+        free(current->buf);
+        current->buf = 0;
+        return;
+    }
 
-        *p = 0;
+    /* print filename if any, and if last line was from
+     * different file */
+    if (lastprinted != current) {
+        current->last = 0;
+        if (!opt_nofilename && current->desc[0])
+            insert_header_line(current);
+    }
 
-        p = logfile->buf = concat_line(logfile->buf, buff);
-    } while (ch != '\n' && ch != EOF);
+    /* if we're dealing with partial lines, and the last
+     * time we showed the line it wasn't finished ... */
+    if (!opt_whole && current->lastpartial) {
+        /* if this is the same file we showed last then
+           append to the last line shown */
+        if (lastprinted == current)
+            append_to_existing_line(current->buf, current);
+        else
+            /* but if a different file has been shown in the
+             * mean time, make a new line, starting with the
+             * continuation string */
+            insert_new_line(current->buf, current, 1);
+    } else
+        /* otherwise just make a plain and simple new line */
+        insert_new_line(current->buf, current, 0);
 
-    logfile->lastpartial = logfile->partial;
-    /* there are 3 ways we could have exited the loop: reading '\n',
-     * reaching EOF, or filling the buffer; the 2nd and 3rd of these
-     * both result in a partial line */
-    logfile->partial = ch != '\n';
+    current->buf = 0;
+    lastprinted = current;
+}
 
-    if (logfile->partial && opt_whole)
+/*
+ * read what's available from a file, but no more than one batch of
+ * lines or bytes, and stop at the deadline; the file stays ready if
+ * there is more.  returns true if anything new has to be displayed.
+ */
+static int read_log(struct logfile_entry *current, long long deadline)
+{
+    int lines = 0;
+    unsigned long bytes = current->bytes_read + BATCH_BYTES;
+
+    if (current->fp)
+        clearerr(current->fp);
+#if HAS_RING
+    else if (current->ring)
+        rt_ring_accept(current->ring); /* any new producers */
+#endif
+    else if (!current->syslog)
+        return 0; /* skip missing files */
+
+    while (source_input(current)) {
+        display_buf(current);
+
+        if (++lines >= batch_lines || current->bytes_read >= bytes
+            || (!(lines & 15) && mono_ms() >= deadline)) {
+            mark_ready(current);
+            current->throttled++;
+            break;
+        }
+    }
+
+    if (!lines) {
+        /* told there was something to read, but there wasn't: the
+         * file may have been truncated */
+        if (current->inode)
+            mark_recheck(current);
         return 0;
+    }
+
+    /* a polled file that is being written to is polled often */
+    if (current->poll_index >= 0 && current->poll_ms > poll_min_ms())
+        schedule_poll(current, poll_min_ms());
 
-#if HAS_REGEX
-    transform_line(logfile->buf);
-#endif
     return 1;
 }
 
-/* input: reads file->fname
- * output: fills file->fp, file->inode
- * returns file->fp
- * in case of error, file->fp is NULL
+/*
+ * read a batch from each file on the ready queue in turn.  files with
+ * more to read go to the back of the queue, so that running out of
+ * time doesn't always hit the same files.  returns true if anything
+ * new has to be displayed.
  */
-FILE *openlog(struct logfile_entry *file)
+static int read_logs(void)
 {
-    struct stat stats;
+    struct logfile_entry *current, *last = ready_tail;
+    long long deadline = mono_ms() + PASS_MS;
+    int got = 0;
 
-    if ((file->fp = fopen(file->fname, "r")) == NULL) {
-        file->fp = NULL;
-        return NULL;
+    while ((current = ready_head)) {
+        if (!(ready_head = current->ready_next))
+            ready_tail = NULL;
+        current->ready = 0;
+
+        if (read_log(current, deadline))
+            got = 1;
+
+        if (current == last || mono_ms() >= deadline)
+            break;
     }
 
-    fstat(fileno(file->fp), &stats);
-    if (S_ISFIFO(stats.st_mode)) {
-        if (fcntl(fileno(file->fp), F_SETFL, O_NONBLOCK) < 0)
-            perror("fcntl"), exit(1);
-        file->inode = 0;
-    } else
-        file->inode = stats.st_ino;
+    return got;
+}
 
-    if (opt_noinitial)
-        fseek(file->fp, 0, SEEK_END);
-    else /* if (stats.st_size > (listlen + 1) * width)
-          * HACK - 'width' is in pixels - how are we to know how much text will
-          * fit? fseek (file->fp, -((listlen + 2) * width/10), SEEK_END); */
-        fseek(file->fp, -5000, SEEK_END);
+/*
+ * start the -reload command without waiting for it; the files are
+ * reopened once it has exited (see reap_children ())
+ */
+static void run_reload_command(void)
+{
+    extern char **environ;
+    char *argv[] = {"sh", "-c", (char *)command, NULL};
+    posix_spawnattr_t attr;
+    sigset_t sigs;
+    int err;
+
+    /* the child must not inherit the signals we block for signalfd,
+     * nor ignore SIGPIPE like we do */
+    posix_spawnattr_init(&attr);
+    sigemptyset(&sigs);
+    posix_spawnattr_setsigmask(&attr, &sigs);
+    sigaddset(&sigs, SIGPIPE);
+    posix_spawnattr_setsigdefault(&attr, &sigs);
+    posix_spawnattr_setflags(&attr,
+                             POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+    if ((err = posix_spawn(&reload_pid, "/bin/sh", NULL, &attr, argv,
+                           environ))) {
+        fprintf(stderr, "cannot run '%s': %s\n", command, strerror(err));
+        reload_pid = 0;
+        do_reopen = 1;
+    }
 
-    file->last_size = stats.st_size;
-    return file->fp;
+    posix_spawnattr_destroy(&attr);
 }
 
-void reopen(void)
+static void reap_children(void)
 {
-    struct logfile_entry *e;
+    pid_t pid;
+    int status;
 
-    for (e = loglist; e; e = e->next) {
-        if (!e->inode)
-            continue; /* skip stdin */
+    do_reap = 0;
 
-        if (e->fp)
-            fclose(e->fp);
-        /* if fp is NULL we will try again later */
-        openlog(e);
-    }
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+        if (pid == reload_pid) {
+            reload_pid = 0;
+            do_reopen = 1;
+        }
+}
 
-    do_reopen = 0;
+/* the next time the timer has to go off */
+static long long next_deadline(void)
+{
+    long long deadline = next_poll;
+
+    if (poll_heap_len && poll_heap[0]->poll_at < deadline)
+        deadline = poll_heap[0]->poll_at;
+
+    if (reload && next_reload < deadline)
+        deadline = next_reload;
+
+    if (state_file && next_state < deadline)
+        deadline = next_state;
+
+    return deadline;
 }
 
-void check_open_files(void)
+#if HAS_EPOLL
+/*
+ * set the timer to the next deadline.  this is done before every wait,
+ * since a file scheduled for polling may be due before the timer is;
+ * the system call is only made when the deadline moved.
+ */
+static void arm_timer(void)
 {
-    struct logfile_entry *e;
-    struct stat stats;
+    struct itimerspec its;
+    long long deadline = next_deadline();
 
-    for (e = loglist; e; e = e->next) {
-        if (!e->inode)
-            continue; /* skip stdin */
+    if (deadline == timer_deadline)
+        return;
+    timer_deadline = deadline;
 
-        if (stat(e->fname, &stats) < 0) { /* file missing? */
-            sleep(1);
-            if (e->fp)
-                fclose(e->fp);
-            if (openlog(e) == NULL)
-                continue;
-            if (fstat(fileno(e->fp), &stats) < 0)
-                continue;
-        }
+    memset(&its, 0, sizeof its);
+    its.it_value.tv_sec = deadline / 1000;
+    its.it_value.tv_nsec = deadline % 1000 * 1000000;
 
-        if (stats.st_ino != e->inode) { /* file renamed? */
-            if (e->fp)
-                fclose(e->fp);
-            if (openlog(e) == NULL)
-                continue;
-            if (fstat(fileno(e->fp), &stats) < 0)
-                continue;
-        }
+    /* an absolute time of zero would disarm the timer */
+    if (!its.it_value.tv_sec && !its.it_value.tv_nsec)
+        its.it_value.tv_nsec = 1;
 
-        if (stats.st_size < e->last_size) { /* file truncated? */
-            fseek(e->fp, 0, SEEK_SET);
-            e->last_size = stats.st_size;
-        }
-    }
+    if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL) < 0)
+        perror("timerfd_settime"), exit(1);
 }
+#endif
 
 /*
- * insert a single node in the list of screen lines and return a
- * pointer to the new node.
- * the caller MUST then fill in ret->line and ret->len with valid
- * data.
+ * the polling timer: check the files that are due for rotation and new
+ * data (files without a watch have no other way of telling us), look
+ * for new files matching the patterns, and reload if it's time to
  */
-static struct line_node *new_line_node(struct logfile_entry *log)
+static void timer_expired(void)
 {
-    struct line_node *new = xmalloc(sizeof(struct line_node));
+    long long now = mono_ms();
 
-    new->logfile = log;
-    new->wrapped_left = 0;
-    new->wrapped_right = 0;
-    new->breaks = 0;
+    /* each poll that finds nothing doubles the time to the next one,
+     * up to -interval; read_log () brings it back down */
+    while (poll_heap_len && poll_heap[0]->poll_at <= now) {
+        struct logfile_entry *e = poll_heap_pop();
+        long long ms = e->poll_ms * 2;
 
-    assert(log);
+        if (file_is_watched(e))
+            continue; /* got a watch since */
 
-    if (!log || !log->last) {
-        new->next = linelist;
-        new->next->prev = new;
+        mark_ready(e);
+        mark_recheck(e);
 
-        new->prev = NULL;
-        linelist = new;
-    } else {
-        /* 2 pointers from the new node */
-        new->next = log->last;
-        new->prev = log->last->prev;
+        if (ms > interval_ms())
+            ms = interval_ms();
+        if (ms < poll_min_ms())
+            ms = poll_min_ms();
+        schedule_poll(e, ms);
+    }
 
-        /* 2 pointers back to the new node */
-        if (new->next)
-            new->next->prev = new;
-        if (new->prev)
-            new->prev->next = new;
+    if (now >= next_poll) {
+        struct glob_source *g;
 
-        /* if this is a new first entry in the list then update
-         * 'linelist' */
-        if (log->last == linelist)
-            linelist = new;
+        /* with inotify, the directories tell us about new matches */
+#if HAS_EPOLL
+        if (inotify_fd < 0)
+#endif
+            for (g = globlist; g; g = g->next)
+                g->rescan = 1;
+
+        next_poll = now + interval_ms();
     }
 
-    /* update the logfile record */
-    if (log)
-        log->last = new;
+    if (state_file && now >= next_state) {
+        /* nothing new on the screen means nothing new read either */
+        if (stats.redraws != state_redraws)
+            save_state();
+        next_state = now + STATE_INTERVAL * 1000LL;
+    }
+
+    if (reload && now >= next_reload) {
+        /* a command still running from last time is left to finish */
+        if (!reload_pid) {
+            if (command && command[0])
+                run_reload_command();
+            else
+                do_reopen = 1;
+        }
+
+        next_reload = now + reload * 1000LL;
+    }
+}
+
+#if HAS_EPOLL
+static struct event_source x_source = {EV_X}, signal_source = {EV_SIGNAL},
+                           timer_source = {EV_TIMER},
+                           inotify_source = {EV_INOTIFY},
+                           stats_source = {EV_STATS};
+
+static void add_source(struct event_source *source, int fd)
+{
+    struct epoll_event ev;
+
+    source->fd = fd;
+    ev.events = EPOLLIN;
+    ev.data.ptr = source;
 
-    return new;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
+        perror("epoll_ctl"), exit(1);
 }
 
 /*
- * this is called after either adding a new line or appending to an
- * old one.  in both cases it's possible that the line no longer fits,
- * and needs wrapping.  this function checks the last line associated
- * with the supplied logfile.
+ * wait for a source of lines to become readable; returns the
+ * registration, or NULL if FD can't be waited on (stdin redirected from
+ * a regular file or /dev/null), in which case it is polled
  */
-static void possibly_split_long_line(struct logfile_entry *log)
+static struct event_source *add_file_source(struct logfile_entry *e, int fd)
 {
-    char *str = log->last->line;
-    int l = strlen(str);
-    char *p = str;
-    struct line_node *line;
-    int spaces;
-    static struct breakinfo *breaks;
-    static int break_buffer_size;
+    struct event_source *source = xmalloc(sizeof(struct event_source));
+    struct epoll_event ev;
+
+    source->type = EV_FILE;
+    source->fd = fd;
+    source->log = e;
+    ev.events = EPOLLIN;
+    ev.data.ptr = source;
+
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        if (errno != EPERM)
+            perror("epoll_ctl"), exit(1);
+        free(source);
+        return NULL;
+    }
 
-    /* only calculate the continuation's width once */
-    if (continuation_width == -1) {
-        continuation_length = strlen(continuation);
-        continuation_width = XmbTextEscapement(log->fontset, continuation,
-                                               continuation_length);
-        continuation_color = GetColor(cont_color);
+    return source;
+}
 
-        /* make an array to store information about the location of
-         * spaces in the line */
-        if (opt_justify) {
-            break_buffer_size = 32;
-            breaks = xmalloc(break_buffer_size * sizeof(struct breakinfo));
+/*
+ * set up the descriptors the main loop waits on: the X connection,
+ * a signalfd for the signals we handle, a timerfd for polling and
+ * -reload, inotify watches on the files, the pipes we read from and
+ * the stats socket
+ */
+static void init_events(void)
+{
+    sigset_t sigs;
+    struct logfile_entry *e;
+    struct glob_source *g;
+
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGINT);
+    sigaddset(&sigs, SIGQUIT);
+    sigaddset(&sigs, SIGTERM);
+    sigaddset(&sigs, SIGHUP);
+    sigaddset(&sigs, SIGUSR1);
+    sigaddset(&sigs, SIGUSR2);
+    sigaddset(&sigs, SIGCHLD);
+
+    if (sigprocmask(SIG_BLOCK, &sigs, NULL) < 0
+        || (epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0
+        || (signal_fd = signalfd(-1, &sigs, SFD_NONBLOCK | SFD_CLOEXEC)) < 0
+        || (timer_fd = timerfd_create(CLOCK_MONOTONIC,
+                                      TFD_NONBLOCK | TFD_CLOEXEC))
+               < 0)
+        perror("init_events"), exit(1);
+
+    add_source(&x_source, ConnectionNumber(disp));
+    add_source(&signal_source, signal_fd);
+    add_source(&timer_source, timer_fd);
+    if (stats_fd >= 0)
+        add_source(&stats_source, stats_fd);
+
+    /* without inotify we simply keep polling */
+    if ((inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) >= 0)
+        add_source(&inotify_source, inotify_fd);
+
+    for (e = loglist; e; e = e->next) {
+        if (e->fp && e->inode && inotify_fd >= 0)
+            watch_file(e);
+        else if (e->fp && !e->inode)
+            /* pipes and stdin can be waited on directly */
+            e->source = add_file_source(e, fileno(e->fp));
+        else if (e->syslog)
+            e->source = add_file_source(e, e->syslog->fd);
+#if HAS_RING
+        else if (e->ring) {
+            /* woken by producers, and by producers attaching */
+            e->source = add_file_source(e, e->ring->event_fd);
+            e->listen_source = add_file_source(e, e->ring->listen_fd);
         }
+#endif
     }
 
-    do {
-        const char *beg = p;
-        int start_w = log->last->wrapped_left ? continuation_width : 0;
-        int w = start_w;
-        int wrapped = 0;
-        char *break_p = NULL;
-        int width_at_break_p = 0;
-        int prefix_len;
+    /* and find the files matching the patterns, watching their
+     * directories for new ones */
+    for (g = globlist; g; g = g->next)
+        scan_glob(g, 1);
 
-        spaces = 0;
+    for (e = loglist; e; e = e->next)
+        poll_unwatched(e);
 
-        if (opt_justify)
-            breaks[spaces].index = breaks[spaces].width = 0;
+    arm_timer();
+}
 
-        while (*p) {
-            int cw, len;
+static void read_signals(void)
+{
+    struct signalfd_siginfo si;
 
-            /* find the length in bytes of the next multibyte character */
-            len = mblen(p, l);
-            if (len <= 0)
-                len = 1; /* ignore (don't skip) illegal character sequences */
+    while (read(signal_fd, &si, sizeof si) == sizeof si) {
+        switch (si.ssi_signo) {
+        case SIGHUP:
+            force_reopen(0);
+            break;
+        case SIGUSR1:
+            force_dump_stats(0);
+            break;
+        case SIGUSR2:
+            force_refresh(0);
+            break;
+        case SIGCHLD:
+            child_exited(0);
+            break;
+        default:
+            force_quit(0);
+            break;
+        }
+    }
+}
 
-            /* find the width in pixels of the next character */
-            cw = XmbTextEscapement(log->fontset, p, len);
-            if (opt_wordwrap && len == 1 && p[0] == ' ' && p != break_p + 1) {
-                break_p = p;
-                width_at_break_p = w;
-                spaces++;
-
-                if (opt_justify) {
-                    /* increase the size of the 'breaks' array when
-                     * necessary */
-                    if (spaces >= break_buffer_size) {
-                        break_buffer_size *= 1.5;
-                        breaks
-                            = xrealloc(breaks, break_buffer_size
-                                                   * sizeof(struct breakinfo));
-                    }
+/*
+ * a name turned up in or went from a directory watched for matches of
+ * a pattern: only that name has to be looked at, unless it is a new
+ * directory, which may have matches in it and need watching itself
+ */
+static void glob_event(struct watch *w, struct inotify_event *ev)
+{
+    struct glob_source *g = w->glob;
+    struct logfile_entry *e;
+    char *fname;
 
-                    /* store information about (a) the location of each
-                     * space */
-                    breaks[spaces].index = p + 1 - beg;
-                    /* (b) the width (in pixels) of the string up to
-                     * this space */
-                    breaks[spaces].width = cw + w - start_w;
-                    /* (c) the length of each 'word' */
-                    breaks[spaces - 1].len
-                        = breaks[spaces].index - breaks[spaces - 1].index;
-                }
-            }
+    if (!ev->len || !w->dir) {
+        g->rescan = 1;
+        return;
+    }
 
-            if (cw + w > width - effect_x_space) {
-                if (p == beg) {
-                    fprintf(
-                        stderr,
-                        "we can't even fit a single character onto the line\n");
-                    if (len == 1)
-                        fprintf(stderr,
-                                "(the character we couldn't fit was '%c')\n",
-                                *p);
-                    exit(1);
+    /* spelled the way glob () would, to match the pattern and find_file () */
+    fname = xmalloc(strlen(w->dir) + ev->len + 2);
+    if (!strcmp(w->dir, "."))
+        strcpy(fname, ev->name);
+    else if (!strcmp(w->dir, "/"))
+        sprintf(fname, "/%s", ev->name);
+    else
+        sprintf(fname, "%s/%s", w->dir, ev->name);
+
+    if (ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+        if (ev->mask & IN_ISDIR)
+            g->rescan = 1;
+        else if (!find_file(fname)
+                 && !fnmatch(g->pattern, fname, FNM_PATHNAME | FNM_PERIOD))
+            add_match(g, fname, 0);
+    } else if ((e = find_file(fname)) && e->glob) {
+        /* read what's left, then check_open_file () lets it go */
+        mark_ready(e);
+        mark_recheck(e);
+    }
+
+    free(fname);
+}
+
+static void read_inotify(void)
+{
+    union {
+        struct inotify_event ev;
+        char buf[4096];
+    } u;
+    int n;
+
+    while ((n = read(inotify_fd, u.buf, sizeof u.buf)) > 0) {
+        char *p = u.buf;
+
+        while (p < u.buf + n) {
+            struct inotify_event *ev = (struct inotify_event *)p;
+            struct watch *w = ev->wd >= 0 && ev->wd < watches_size
+                                  ? watches + ev->wd
+                                  : NULL;
+
+            if (ev->mask & IN_Q_OVERFLOW) {
+                /* events were lost; only a full look will do */
+                struct glob_source *g;
+
+                for (g = globlist; g; g = g->next)
+                    g->rescan = 1;
+            } else if (w && w->glob)
+                glob_event(w, ev);
+            else if (w && w->log) {
+                struct logfile_entry *e = w->log;
+
+                if (ev->mask & IN_IGNORED) {
+                    if (e->wd == ev->wd)
+                        e->wd = -1;
+                    w->log = NULL;
+                    poll_unwatched(e);
                 }
 
-                wrapped = 1;
-                break;
+                /* read what's left before looking for a new file */
+                if (ev->mask & (IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF))
+                    mark_recheck(e);
+
+                mark_ready(e);
             }
 
-            w += cw;
-            p += len;
-            l -= len;
+            p += sizeof(struct inotify_event) + ev->len;
         }
+    }
+}
 
-        /* if we're wrapping at spaces, and the line is long enough to
-         * wrap, and we've seen a space already, and the space wasn't
-         * the first character on the line, then wrap at the space */
-        if (!wrapped)
-            break;
-
-        /* choose where to break the line */
-        if (opt_wordwrap && break_p && break_p != beg) {
-            prefix_len = break_p - beg;
-            p = break_p;
-            w = width_at_break_p;
-
-            /* if breaking at a space, skip all adjacent spaces */
-            while (*p == ' ') {
-                int len = mblen(p, l);
-                if (len != 1)
-                    break;
-                p++;
-            }
+/*
+ * wait until there is something to do, and note what it is.  nothing
+ * is read or drawn here.
+ */
+static void wait_for_events(int block)
+{
+    struct epoll_event events[16];
+    uint64_t expirations;
+    int i, n;
 
-            if (opt_justify) {
-                spaces--;
-                breaks[spaces].len--;
-            }
-        } else
-            prefix_len = p - beg;
+    XFlush(disp);
+    arm_timer();
 
-        /* make a copy of the tail end of the string */
-        p = xstrdup(p);
+    /* Xlib may already have read events off the connection */
+    if (XPending(disp))
+        block = 0;
 
-        /* and reduce the size of the head of the string */
-        log->last->line = xrealloc(log->last->line, prefix_len + 1);
-        log->last->len = prefix_len;
-        log->last->line[prefix_len] = '\0';
+    TRACE_BEGIN("epoll_wait");
+    n = epoll_wait(epoll_fd, events, 16, block ? -1 : 0);
+    TRACE_END();
 
-        /* note that the head was wrapped on it's right */
-        log->last->wrapped_right = 1;
+    for (i = 0; i < n; i++) {
+        struct event_source *source = events[i].data.ptr;
 
-        /* 'spaces' includes any space we broke on; we can only justify
-         * if there's at least one other space */
-        if (opt_justify && spaces
-            && width - effect_x_space - width_at_break_p
-                   < spaces * log->font_height) {
-            int i;
-            log->last->free_pixels = width - effect_x_space - w;
-            log->last->num_words = spaces + 1;
-            log->last->breaks
-                = malloc(log->last->num_words * sizeof(struct breakinfo));
-            for (i = 0; i < log->last->num_words; i++)
-                log->last->breaks[i] = breaks[i];
+        switch (source->type) {
+        case EV_X:
+            break; /* handled by XPending () */
+        case EV_SIGNAL:
+            read_signals();
+            break;
+        case EV_TIMER:
+            if (read(timer_fd, &expirations, sizeof expirations) > 0) {
+                timer_deadline = 0;
+                timer_expired();
+            }
+            break;
+        case EV_INOTIFY:
+            read_inotify();
+            break;
+        case EV_STATS:
+            serve_stats();
+            break;
+        case EV_STATS_CLIENT:
+            if (write_stats_client(source->client))
+                free_stats_client(source->client);
+            break;
+        case EV_FILE:
+            mark_ready(source->log);
+
+            /* a pipe without writers stays readable forever; fall
+             * back to polling it */
+            if (events[i].events & EPOLLHUP
+                && !(events[i].events & EPOLLIN)) {
+                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, source->fd, NULL);
+                if (source == source->log->source)
+                    source->log->source = NULL;
+#if HAS_RING
+                else if (source == source->log->listen_source)
+                    source->log->listen_source = NULL;
+#endif
+                poll_unwatched(source->log);
+                free(source);
+            }
+            break;
         }
+    }
+}
+#else  /* HAS_EPOLL */
+static void init_events(void)
+{
+    struct logfile_entry *e;
+    struct glob_source *g;
 
-        line = new_line_node(log);
-        line->line = p;
-        l = line->len = strlen(p);
+    for (g = globlist; g; g = g->next)
+        scan_glob(g, 1);
 
-        /* note that the tail end of the string is wrapped at its left */
-        line->wrapped_left = 1;
-    } while (l);
+    for (e = loglist; e; e = e->next)
+        poll_unwatched(e);
+
+    install_signal(SIGINT, force_quit);
+    install_signal(SIGQUIT, force_quit);
+    install_signal(SIGTERM, force_quit);
+    install_signal(SIGHUP, force_reopen);
+    install_signal(SIGUSR1, force_dump_stats);
+    install_signal(SIGUSR2, force_refresh);
+    install_signal(SIGCHLD, child_exited);
 }
 
-static void insert_new_line(char *str, struct logfile_entry *log)
+static void wait_for_events(int block)
 {
-    struct line_node *new;
-    new = new_line_node(log);
-    new->line = str;
-    new->len = strlen(str);
+    fd_set fdr, fdw;
+    struct stats_client *c, *next;
+    struct timeval to = {0, 0};
+    int maxfd = ConnectionNumber(disp);
+    long long timeout = next_deadline() - mono_ms();
 
-    possibly_split_long_line(log);
-}
+    XFlush(disp);
 
-/*
- * append something to an existing physical line. this is done
- * by deleting the file on-screen, concatenating the new data to it
- * and splitting it again.
- */
-static void append_to_existing_line(char *str, struct logfile_entry *log)
-{
-    char *old, *new;
+    if (XPending(disp))
+        block = 0;
 
-    assert(log);
-    assert(log->last);
+    if (block && timeout > 0) {
+        to.tv_sec = timeout / 1000;
+        to.tv_usec = timeout % 1000 * 1000;
+    }
 
-    old = log->last->line;
-    assert(old);
+    FD_ZERO(&fdr);
+    FD_ZERO(&fdw);
+    FD_SET(ConnectionNumber(disp), &fdr);
+    if (stats_fd >= 0) {
+        FD_SET(stats_fd, &fdr);
+        if (stats_fd > maxfd)
+            maxfd = stats_fd;
+    }
+    for (c = stats_clients; c; c = c->next) {
+        FD_SET(c->fd, &fdw);
+        if (c->fd > maxfd)
+            maxfd = c->fd;
+    }
 
-    new = concat_line(old, str);
-    free(str);
-    log->last->line = new;
-    log->last->len = strlen(new);
-    possibly_split_long_line(log);
+    TRACE_BEGIN("select");
+    /* the signal handlers only set flags, and interrupt this */
+    if (select(maxfd + 1, &fdr, &fdw, 0, &to) > 0) {
+        for (c = stats_clients; c; c = next) {
+            next = c->next;
+            if (FD_ISSET(c->fd, &fdw) && write_stats_client(c))
+                free_stats_client(c);
+        }
+        if (stats_fd >= 0 && FD_ISSET(stats_fd, &fdr))
+            serve_stats();
+    }
+    TRACE_END();
+
+    if (mono_ms() >= next_deadline())
+        timer_expired();
 }
+#endif /* HAS_EPOLL */
 
 static void main_loop(void)
 {
-    int lin;
-    time_t lastreload;
     Region region = XCreateRegion();
     XEvent xev;
-    struct logfile_entry *lastprinted = NULL;
-    struct logfile_entry *current;
+    struct glob_source *g;
     int need_update = 1;
+    long long last_redraw = 0;
 
-    display = xmalloc(sizeof(struct displaymatrix) * listlen);
-
-    lastreload = time(NULL);
-
-    /* Initialize line_node */
-    for (lin = 0; lin < listlen; lin++) {
-        struct line_node *e = xmalloc(sizeof(struct line_node));
-        e->line = xstrdup("~");
-        e->len = 1;
-        e->logfile
-            = loglist; /* this is only needed to get a color for the '~' */
-        e->wrapped_left = 0;
-        e->wrapped_right = 0;
-        e->breaks = 0;
-        e->next = NULL;
-        e->prev = linelist_tail;
+    next_poll = next_reload = next_state = mono_ms();
+    next_poll += interval_ms();
+    next_state += STATE_INTERVAL * 1000LL;
+    next_reload += reload * 1000LL;
 
-        if (!linelist)
-            linelist = e;
-        if (linelist_tail)
-            linelist_tail->next = e;
-        linelist_tail = e;
+    init_events();
 
-        display[lin].line = xstrdup("");
-        display[lin].len = 0;
-        display[lin].offset = 0;
-        display[lin].buffer_size = 0;
-    }
+    init_linelist();
+    restore_lines();
 
     for (;;) {
-        /* read logs */
-        for (current = loglist; current; current = current->next) {
-            if (!current->fp)
-                continue; /* skip missing files */
-
-            clearerr(current->fp);
-
-            while (lineinput(current)) {
-                need_update = 1;
-                /* if we're trying to update old partial lines in
-                 * place, and the last time this file was updated the
-                 * output was partial, and that partial line is not
-                 * too close to the top of the screen, then update
-                 * that partial line */
-                if (opt_update && current->lastpartial && current->last) {
-                    append_to_existing_line(current->buf, current);
-                    current->buf = 0;
-                    continue;
-                }
+        int busy = 0;
 
-                /* if all we just read was a newline ending a line that we've
-                 * already displayed, skip it */
-                if (current->buf[0] == '\0' && current->lastpartial) {
-                    free(current->buf);
-                    current->buf = 0;
-                    continue;
-                }
+        /* read logs */
+        if (read_logs())
+            need_update = 1;
 
-                /* print filename if any, and if last line was from
-                 * different file */
-                if (lastprinted != current) {
-                    current->last = 0;
-                    if (!opt_nofilename && current->desc[0]) {
-                        insert_new_line(xstrdup("["), current);
-                        append_to_existing_line(xstrdup(current->desc),
-                                                current);
-                        append_to_existing_line(xstrdup("]"), current);
-                    }
-                }
+        /* look for rotated files only after reading what's left */
+        if (check_open_files())
+            need_update = 1;
 
-                /* if we're dealing with partial lines, and the last
-                 * time we showed the line it wasn't finished ... */
-                if (!opt_whole && current->lastpartial) {
-                    /* if this is the same file we showed last then
-                       append to the last line shown */
-                    if (lastprinted == current)
-                        append_to_existing_line(current->buf, current);
-                    else {
-                        /* but if a different file has been shown in the
-                         * mean time, make a new line, starting with the
-                         * continuation string */
-                        insert_new_line(current->buf, current);
-                        current->last->wrapped_left = 1;
-                    }
-                } else
-                    /* otherwise just make a plain and simple new line */
-                    insert_new_line(current->buf, current);
+        for (g = globlist; g; g = g->next)
+            if (g->rescan)
+                scan_glob(g, 0);
 
-                current->buf = 0;
-                lastprinted = current;
-            }
-        }
+        busy = ready_head != NULL;
 
-        if (need_update) {
+        /* while files are still being caught up on, redraw only
+         * every so often */
+        if (need_update && (!busy || mono_ms() >= last_redraw + PASS_MS)) {
             redraw(0);
+            stats_lines_drawn();
             need_update = 0;
-        } else {
-            XFlush(disp);
-
-            if (!XPending(disp)) {
-                fd_set fdr;
-                struct timeval to = interval;
-
-                FD_ZERO(&fdr);
-                FD_SET(ConnectionNumber(disp), &fdr);
-                select(ConnectionNumber(disp) + 1, &fdr, 0, 0, &to);
-            }
+            last_redraw = mono_ms();
         }
 
-        check_open_files();
-
-        if (do_reopen)
-            reopen();
+        TRACE_BEGIN("x_events");
 
         /* we ignore possible errors due to window resizing &c */
         while (XPending(disp)) {
@@ -1166,6 +4314,42 @@ static void main_loop(void)
 
                 XUnionRectWithRegion(&r, region, region);
             } break;
+            case PropertyNotify:
+                if (xev.xproperty.atom == nautilus_atom)
+                    do_find_root = 1;
+                else if (xev.xproperty.atom == rootpmap_atom && opt_bgcache)
+                    do_capture_background = 1;
+                break;
+            case CreateNotify:
+                note_window_size(xev.xcreatewindow.window,
+                                 xev.xcreatewindow.x, xev.xcreatewindow.y,
+                                 xev.xcreatewindow.width,
+                                 xev.xcreatewindow.height);
+                break;
+            case ConfigureNotify:
+                note_window_size(xev.xconfigure.window, xev.xconfigure.x,
+                                 xev.xconfigure.y, xev.xconfigure.width,
+                                 xev.xconfigure.height);
+                break;
+            case MapNotify:
+                /* a new virtual root matters only while there is none.
+                 * asking a window for its property takes a round trip,
+                 * so only those that cover the screen are asked */
+                if (root_parent == None && !xev.xmap.override_redirect
+                    && screen_window_index(xev.xmap.window) >= 0
+                    && is_virtual_root(xev.xmap.window))
+                    do_find_root = 1;
+                break;
+            case UnmapNotify:
+                if (root_parent != None && xev.xunmap.window == root_parent)
+                    do_find_root = 1;
+                break;
+            case DestroyNotify:
+                forget_screen_window(xev.xdestroywindow.window);
+                if (root_parent != None
+                    && xev.xdestroywindow.window == root_parent)
+                    do_find_root = 1;
+                break;
             default:
 #ifdef DEBUGMODE
                 fprintf(stderr, "PANIC! Unknown event %d\n", xev.type);
@@ -1174,13 +4358,17 @@ static void main_loop(void)
             }
         }
 
-        /* reload if requested */
-        if (reload && lastreload + reload < time(NULL)) {
-            if (command && command[0])
-                system(command);
+        TRACE_END();
 
-            reopen();
-            lastreload = time(NULL);
+        if (do_find_root) {
+            do_find_root = 0;
+            find_root_again();
+        }
+
+        if (do_capture_background) {
+            do_capture_background = 0;
+            capture_background();
+            redraw(1);
         }
 
         if (!XEmptyRegion(region)) {
@@ -1194,7 +4382,52 @@ static void main_loop(void)
             XDestroyRegion(region);
             region = XCreateRegion();
         }
+
+        if (do_refresh) {
+            redraw(1);
+            do_refresh = 0;
+        }
+
+        if (do_dump_stats) {
+            list_files(0);
+            dump_stats(stderr);
+#ifdef TRACE
+            trace_dump();
+#endif
+            do_dump_stats = 0;
+        }
+
+        if (do_quit) {
+            if (state_file)
+                save_state();
+            blank_window(0);
+        }
+
+        if (do_reap)
+            reap_children();
+
+        if (do_reopen)
+            reopen();
+
+        wait_for_events(!busy && !do_reopen && !do_reap);
+    }
+}
+
+/* ARG, the value given to option OPT, as a number of at least MIN */
+static int number_arg(const char *opt, const char *arg, int min)
+{
+    char *end;
+    long n = arg ? strtol(arg, &end, 10) : 0;
+
+    if (!arg || end == arg || *end || n < min || n > INT_MAX) {
+        fprintf(stderr,
+                "%s needs a number of at least %d.\n"
+                "Try --help for more information.\n",
+                opt, min);
+        exit(1);
     }
+
+    return n;
 }
 
 int main(int argc, char *argv[])
@@ -1206,7 +4439,10 @@ int main(int argc, char *argv[])
     char *transform = NULL;
 #endif
 
+    stats.start_ms = mono_ms();
+
     setlocale(LC_CTYPE, ""); /* try to initialize the locale. */
+    utf8_locale = !strcmp(nl_langinfo(CODESET), "UTF-8");
 
     for (i = 1; i < argc; i++) {
         const char *arg = argv[i];
@@ -1251,6 +4487,8 @@ int main(int argc, char *argv[])
                 opt_minspace = 1;
             else if (!strcmp(arg, "-noflicker"))
                 opt_noflicker = 1;
+            else if (!strcmp(arg, "-bgcache"))
+                opt_bgcache = 1;
             else if (!strcmp(arg, "-frame"))
                 opt_frame = 1;
             else if (!strcmp(arg, "-no-filename"))
@@ -1271,6 +4509,54 @@ int main(int argc, char *argv[])
                 def_color = argv[++i];
             else if (!strcmp(arg, "-noinitial"))
                 opt_noinitial = 1;
+            else if (!strcmp(arg, "-batch"))
+                batch_lines = number_arg(arg, argv[++i], 1);
+            else if (!strcmp(arg, "-maxline"))
+                max_line = number_arg(arg, argv[++i], 0);
+            else if (!strcmp(arg, "-maxrows"))
+                max_rows = number_arg(arg, argv[++i], 0);
+            else if (!strcmp(arg, "-stats-socket"))
+                stats_socket = argv[++i];
+            else if (!strcmp(arg, "-state"))
+                state_file = argv[++i];
+            else if (!strcmp(arg, "-syslog")) {
+                struct logfile_entry *e;
+                const char *fcolor, *desc;
+
+                split_spec(argv[++i], &fcolor, &desc);
+
+                e = new_logfile(argv[i], desc, fcolor, fontname);
+                e->syslog = open_syslog(argv[i]);
+                add_file(e);
+                file_count++;
+            }
+#if HAS_RING
+            else if (!strcmp(arg, "-ring")) {
+                struct logfile_entry *e;
+                const char *fcolor, *desc;
+
+                split_spec(argv[++i], &fcolor, &desc);
+
+                e = new_logfile(argv[i], desc, fcolor, fontname);
+                if (!(e->ring = rt_ring_create(argv[i]))) {
+                    if (errno == EEXIST)
+                        fprintf(stderr, "%s: exists and isn't our ring, not "
+                                        "replacing it\n", argv[i]);
+                    else if (errno == EADDRINUSE)
+                        fprintf(stderr, "%s: in use by another root-tail\n",
+                                argv[i]);
+                    else
+                        perror(argv[i]);
+                    exit(1);
+                }
+                add_file(e);
+                file_count++;
+            }
+#endif
+#ifdef TRACE
+            else if (!strcmp(arg, "-trace"))
+                trace_file = argv[++i];
+#endif
             else if (!strcmp(arg, "-id")) {
                 unsigned long id;
 
@@ -1290,64 +4576,78 @@ int main(int argc, char *argv[])
             }
         } else { /* it must be a filename */
             struct logfile_entry *e;
-            const char *fname, *desc, *fcolor = def_color;
-            char *p;
+            const char *fname = arg, *desc, *fcolor;
 
             file_count++;
 
-            /* this is not foolproof yet (',' in filenames are not allowed) */
-            fname = desc = arg;
-            if ((p = strchr(arg, ','))) {
-                *p = '\0';
-                fcolor = p + 1;
-
-                if ((p = strchr(fcolor, ','))) {
-                    *p = '\0';
-                    desc = p + 1;
-                }
-            }
-
-            e = xmalloc(sizeof(struct logfile_entry));
-            e->partial = 0;
-            e->buf = 0;
+            split_spec(argv[i], &fcolor, &desc);
 
             if (arg[0] == '-' && arg[1] == '\0') {
+                e = new_logfile(NULL, desc == arg ? "stdin" : desc, fcolor,
+                                fontname);
+
                 if ((e->fp = fdopen(0, "r")) == NULL)
                     perror("fdopen"), exit(1);
                 if (fcntl(0, F_SETFL, O_NONBLOCK) < 0)
                     perror("fcntl"), exit(1);
 
-                e->fname = NULL;
                 e->inode = 0;
-                if (desc == arg)
-                    e->desc = xstrdup("stdin");
-                else
-                    e->desc = xstrdup(desc);
+                mark_ready(e);
+            } else if (is_pattern(fname)) {
+                struct glob_source *g = xmalloc(sizeof(struct glob_source));
+                struct stat st;
+
+                memset(g, 0, sizeof(struct glob_source));
+                g->proto.state_index = -1; /* its lines aren't saved */
+
+                /* a directory means all the files in it */
+                if (stat(fname, &st) == 0 && S_ISDIR(st.st_mode)) {
+                    g->pattern = xmalloc(strlen(fname) + 3);
+                    sprintf(g->pattern, "%s/*", fname);
+                } else
+                    g->pattern = xstrdup(fname);
+
+                /* without a desc, each file is described by its name */
+                g->proto.desc = desc == arg ? NULL : xstrdup(desc);
+                g->proto.colorname = fcolor;
+                g->proto.fontname = fontname;
+
+                if (!globlist)
+                    globlist = g;
+                if (globlist_tail)
+                    globlist_tail->next = g;
+                globlist_tail = g;
+
+                /* as far as -whole is concerned, this is many files */
+                file_count++;
+                continue;
             } else {
-                e->fname = xstrdup(fname);
+                e = new_logfile(fname, desc, fcolor, fontname);
 
                 if (openlog(e) == NULL)
                     perror(fname), exit(1);
-
-                e->desc = xstrdup(desc);
             }
 
-            e->colorname = fcolor;
-            e->partial = 0;
-            e->fontname = fontname;
-            e->last = NULL;
-            e->next = NULL;
+            add_file(e);
+        }
+    }
+
+    if (state_file) {
+        struct logfile_entry *e;
 
-            if (!loglist)
-                loglist = e;
-            if (loglist_tail)
-                loglist_tail->next = e;
+        load_state();
 
-            loglist_tail = e;
-        }
+        /* the files were opened before we knew where we got to */
+        for (e = loglist; e; e = e->next)
+            if (e->fp && e->inode) {
+                fclose(e->fp);
+                e->inode = 0;
+                if (openlog(e) == NULL)
+                    perror(e->fname), exit(1);
+            }
     }
 
-    if (!loglist) {
+    if (!loglist && !globlist) {
         fprintf(stderr,
                 "You did not specify any files to tail\n"
                 "use %s --help for help\n",
@@ -1420,14 +4720,14 @@ int main(int argc, char *argv[])
         effect_x_offset = effect_y_offset = 0;
     }
 
+    select_draw_rows();
+
+    stats.started = time(NULL);
+
     InitWindow();
 
-    install_signal(SIGINT, blank_window);
-    install_signal(SIGQUIT, blank_window);
-    install_signal(SIGTERM, blank_window);
-    install_signal(SIGHUP, force_reopen);
-    install_signal(SIGUSR1, list_files);
-    install_signal(SIGUSR2, force_refresh);
+    if (stats_socket)
+        open_stats_socket();
 
     if (opt_daemonize)
         daemonize();
@@ -1453,6 +4753,8 @@ void *xstrdup(const char *string)
 {
     void *p;
 
+    stats.allocations++;
+
     while ((p = strdup(string)) == NULL) {
         fprintf(stderr, "Memory exhausted in xstrdup ().\n");
         sleep(10);
@@ -1465,6 +4767,8 @@ void *xmalloc(size_t size)
 {
     void *p;
 
+    stats.allocations++;
+
     while ((p = malloc(size)) == NULL) {
         fprintf(stderr, "Memory exhausted in xmalloc ().\n");
         sleep(10);
@@ -1477,6 +4781,8 @@ void *xrealloc(void *ptr, size_t size)
 {
     void *p;
 
+    stats.allocations++;
+
     while ((p = realloc(ptr, size)) == NULL) {
         fprintf(stderr, "Memory exhausted in xrealloc ().\n");
         sleep(10);
@@ -1510,12 +4816,43 @@ void display_help(char *myname)
            " -shade                    add shading to font\n"
            " -outline                  add black outline to font\n"
            " -minspace                 force minimum line spacing\n"
+           " -bgcache                  erase lines from a saved copy of the "
+           "background\n"
            " -noinitial                don't display the last file lines on\n"
            "                           startup\n"
            " -i | -interval seconds    interval between checks (fractional\n"
            "                           values o.k.). Default 2.4 seconds\n"
+           " -batch lines              read at most this many lines from a "
+           "file before\n"
+           "                           looking at the others. Default "
+           "%d\n"
+           " -maxline bytes            keep at most this many bytes of a "
+           "line\n"
+           "                           (0 means no limit). Default %d\n"
+           " -maxrows rows             show at most this many rows of a "
+           "wrapped line\n"
+           "                           (0 means no limit). Default %d\n"
+           " -stats-socket path        serve runtime statistics on a unix "
+           "socket\n"
+           " -state file               save where we got to in file, and "
+           "carry on\n"
+           "                           from there when restarted\n"
+           " -syslog path[,color[,desc]]\n"
+           "                           show messages sent to a unix datagram "
+           "socket\n"
+           "                           (or to udp:PORT on localhost)\n"
+#if HAS_RING
+           " -ring path[,color[,desc]] show lines written to a shared memory "
+           "ring\n"
+           "                           (see rtring.h)\n"
+#endif
+#ifdef TRACE
+           " -trace file               write trace events to file on "
+           "SIGUSR1\n"
+#endif
            " -V                        display version information and exit\n"
-           "\n");
+           "\n",
+           DEF_BATCH_LINES, DEF_MAX_LINE, DEF_MAX_ROWS);
     printf("Example:\n%s -g 800x250+100+50 -font fixed /var/log/messages,green "
            "/var/log/secure,red,'ALERT'\n",
            myname);
@@ -0,0 +1,403 @@
+/*
+ * rtring.c - the shared-memory line ring between producers and
+ * root-tail, see rtring.h
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ */
+
+#ifdef __linux__
+
+#include "rtring.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/* the socket producers attach through is PATH.sock */
+static int socket_addr(const char *path, struct sockaddr_un *addr)
+{
+    memset(addr, 0, sizeof *addr);
+    addr->sun_family = AF_UNIX;
+
+    if (strlen(path) + 5 >= sizeof addr->sun_path) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    sprintf(addr->sun_path, "%s.sock", path);
+    return 0;
+}
+
+static void free_ring(struct rt_ring *ring)
+{
+    int saved = errno;
+
+    if (ring->shared)
+        munmap(ring->shared, sizeof(struct rt_ring_shared));
+    if (ring->event_fd >= 0)
+        close(ring->event_fd);
+    if (ring->listen_fd >= 0)
+        close(ring->listen_fd);
+    free(ring->path);
+    free(ring);
+
+    errno = saved;
+}
+
+static struct rt_ring *new_ring(void)
+{
+    struct rt_ring *ring = malloc(sizeof(struct rt_ring));
+
+    if (ring) {
+        ring->shared = NULL;
+        ring->event_fd = ring->listen_fd = -1;
+        ring->path = NULL;
+    }
+
+    return ring;
+}
+
+/*
+ * attach to the ring root-tail made at PATH.  returns NULL (and sets
+ * errno) if there is none, or root-tail doesn't answer.
+ */
+struct rt_ring *rt_ring_open(const char *path)
+{
+    struct rt_ring *ring;
+    struct sockaddr_un addr;
+    struct timeval timeout = {1, 0};
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    char byte;
+    void *shared;
+    int fd, sock;
+
+    if (socket_addr(path, &addr) < 0 || !(ring = new_ring()))
+        return NULL;
+
+    if ((fd = open(path, O_RDWR | O_CLOEXEC)) < 0) {
+        free_ring(ring);
+        return NULL;
+    }
+
+    shared = mmap(NULL, sizeof(struct rt_ring_shared), PROT_READ | PROT_WRITE,
+                  MAP_SHARED, fd, 0);
+    close(fd);
+    if (shared == MAP_FAILED) {
+        free_ring(ring);
+        return NULL;
+    }
+
+    ring->shared = shared;
+    if (ring->shared->magic != RT_RING_MAGIC
+        || ring->shared->slots != RT_RING_SLOTS) {
+        free_ring(ring);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    /* root-tail answers with the eventfd to wake it with */
+    if ((sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
+        free_ring(ring);
+        return NULL;
+    }
+
+    memset(&msg, 0, sizeof msg);
+    iov.iov_base = &byte;
+    iov.iov_len = 1;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof control.buf;
+
+    if (setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout) < 0
+        || connect(sock, (struct sockaddr *)&addr, sizeof addr) < 0
+        || recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) != 1) {
+        close(sock);
+        free_ring(ring);
+        return NULL;
+    }
+
+    close(sock);
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_level != SOL_SOCKET
+        || cmsg->cmsg_type != SCM_RIGHTS) {
+        free_ring(ring);
+        errno = EPROTO;
+        return NULL;
+    }
+
+    memcpy(&ring->event_fd, CMSG_DATA(cmsg), sizeof(int));
+    return ring;
+}
+
+/*
+ * queue a line for root-tail.  returns 0, or -1 if the ring was full
+ * and the line was dropped.
+ */
+int rt_ring_write(struct rt_ring *ring, const char *line, size_t len)
+{
+    struct rt_ring_shared *s = ring->shared;
+    struct rt_ring_slot *slot;
+    unsigned long pos = __atomic_load_n(&s->enqueue_pos, __ATOMIC_RELAXED);
+
+    for (;;) {
+        unsigned long seq;
+
+        slot = &s->slot[pos & (RT_RING_SLOTS - 1)];
+        seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+
+        if (seq == pos) {
+            /* the slot is free; claim it, unless another producer was
+             * quicker, in which case pos is updated to its position */
+            if (__atomic_compare_exchange_n(&s->enqueue_pos, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED))
+                break;
+        } else if ((long)(seq - pos) < 0) {
+            /* root-tail hasn't read this slot's last line yet */
+            __atomic_fetch_add(&s->dropped, 1, __ATOMIC_RELAXED);
+            errno = EAGAIN;
+            return -1;
+        } else
+            pos = __atomic_load_n(&s->enqueue_pos, __ATOMIC_RELAXED);
+    }
+
+    if (len > RT_RING_LINE_MAX)
+        len = RT_RING_LINE_MAX;
+
+    memcpy(slot->line, line, len);
+    slot->len = len;
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+
+    /* pairs with the fence in rt_ring_peek (): either we see that
+     * root-tail is waiting, or it sees the line */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&s->waiting, __ATOMIC_RELAXED)
+        && __atomic_exchange_n(&s->waiting, 0, __ATOMIC_ACQ_REL)) {
+        uint64_t one = 1;
+
+        if (write(ring->event_fd, &one, sizeof one) < 0) {
+            /* the counter is saturated, so root-tail is woken anyway */
+        }
+    }
+
+    return 0;
+}
+
+void rt_ring_close(struct rt_ring *ring)
+{
+    free_ring(ring);
+}
+
+/*
+ * true if what an earlier run left at PATH and its socket may be
+ * replaced: files of our own, that nobody serves any more.  otherwise
+ * errno is EEXIST (somebody else's files), or EADDRINUSE (a ring still
+ * in use).
+ */
+static int stale_ring(const char *path, struct sockaddr_un *addr)
+{
+    struct stat st;
+    int probe, r;
+
+    if (lstat(path, &st) == 0
+        && (!S_ISREG(st.st_mode) || st.st_uid != geteuid())) {
+        errno = EEXIST;
+        return 0;
+    }
+
+    if (lstat(addr->sun_path, &st) < 0)
+        return 1;
+
+    if (!S_ISSOCK(st.st_mode) || st.st_uid != geteuid()) {
+        errno = EEXIST;
+        return 0;
+    }
+
+    if ((probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) >= 0) {
+        r = connect(probe, (struct sockaddr *)addr, sizeof *addr);
+        close(probe);
+        if (r == 0) {
+            errno = EADDRINUSE;
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/*
+ * make a new ring at PATH, and the socket producers attach through,
+ * both only for our own user.  returns NULL (and sets errno) on failure.
+ */
+struct rt_ring *rt_ring_create(const char *path)
+{
+    struct rt_ring *ring;
+    struct sockaddr_un addr;
+    void *shared;
+    unsigned long i;
+    int fd;
+
+    if (socket_addr(path, &addr) < 0 || !(ring = new_ring()))
+        return NULL;
+
+    if (!stale_ring(path, &addr) || !(ring->path = strdup(path))) {
+        free_ring(ring);
+        return NULL;
+    }
+
+    /* a new file rather than truncating the old one: producers still
+     * attached to that would fault */
+    unlink(path);
+    unlink(addr.sun_path);
+
+    if ((fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600)) < 0) {
+        free_ring(ring);
+        return NULL;
+    }
+
+    if (fchmod(fd, 0600) < 0
+        || ftruncate(fd, sizeof(struct rt_ring_shared)) < 0
+        || (shared = mmap(NULL, sizeof(struct rt_ring_shared),
+                          PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0))
+               == MAP_FAILED) {
+        close(fd);
+        free_ring(ring);
+        return NULL;
+    }
+
+    close(fd);
+    ring->shared = shared;
+
+    for (i = 0; i < RT_RING_SLOTS; i++)
+        ring->shared->slot[i].seq = i;
+    ring->shared->slots = RT_RING_SLOTS;
+    __atomic_store_n(&ring->shared->magic, RT_RING_MAGIC, __ATOMIC_RELEASE);
+
+    if ((ring->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0
+        || (ring->listen_fd = socket(AF_UNIX,
+                                     SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                                     0))
+               < 0
+        || bind(ring->listen_fd, (struct sockaddr *)&addr, sizeof addr) < 0
+        || chmod(addr.sun_path, 0600) < 0 || listen(ring->listen_fd, 16) < 0) {
+        rt_ring_unlink(ring);
+        free_ring(ring);
+        return NULL;
+    }
+
+    return ring;
+}
+
+/* remove the files of a ring made by rt_ring_create () */
+void rt_ring_unlink(struct rt_ring *ring)
+{
+    struct sockaddr_un addr;
+    int saved = errno;
+
+    if (ring->path) {
+        unlink(ring->path);
+        if (socket_addr(ring->path, &addr) == 0)
+            unlink(addr.sun_path);
+    }
+
+    errno = saved;
+}
+
+/* hand our eventfd to every producer waiting to attach */
+void rt_ring_accept(struct rt_ring *ring)
+{
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    char byte = 0;
+    int fd;
+
+    while ((fd = accept(ring->listen_fd, NULL, NULL)) >= 0) {
+        memset(&msg, 0, sizeof msg);
+        iov.iov_base = &byte;
+        iov.iov_len = 1;
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof control.buf;
+
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &ring->event_fd, sizeof(int));
+
+        /* a producer that went away already doesn't matter */
+        sendmsg(fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+        close(fd);
+    }
+}
+
+/*
+ * the next line in the ring, or NULL if there is none, in which case
+ * the next producer to write a line wakes us through the eventfd.
+ * the line stays valid until rt_ring_release ().
+ */
+const char *rt_ring_peek(struct rt_ring *ring, unsigned int *len)
+{
+    struct rt_ring_shared *s = ring->shared;
+    struct rt_ring_slot *slot = &s->slot[s->dequeue_pos & (RT_RING_SLOTS - 1)];
+
+    if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != s->dequeue_pos + 1) {
+        uint64_t count;
+
+        /* ask for a wakeup, and look again in case a line came in
+         * before the producer could have seen us asking */
+        if (read(ring->event_fd, &count, sizeof count) < 0) {
+            /* nothing to clear */
+        }
+        __atomic_store_n(&s->waiting, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE)
+            != s->dequeue_pos + 1)
+            return NULL;
+    }
+
+    *len = slot->len > RT_RING_LINE_MAX ? RT_RING_LINE_MAX : slot->len;
+    return slot->line;
+}
+
+/* done with the line rt_ring_peek () returned; its slot is free again */
+void rt_ring_release(struct rt_ring *ring)
+{
+    struct rt_ring_shared *s = ring->shared;
+    unsigned long pos = s->dequeue_pos;
+
+    __atomic_store_n(&s->slot[pos & (RT_RING_SLOTS - 1)].seq,
+                     pos + RT_RING_SLOTS, __ATOMIC_RELEASE);
+    s->dequeue_pos = pos + 1;
+}
+
+#endif /* __linux__ */
@@ -0,0 +1,82 @@
+/*
+ * rtring.h - put lines on root-tail's screen through shared memory
+ *
+ * root-tail -ring PATH creates a ring of fixed size slots in the file
+ * PATH (best on a tmpfs such as /dev/shm), and listens on the unix
+ * socket PATH.sock.  Any number of processes can then attach to it and
+ * write lines without touching the filesystem:
+ *
+ *     struct rt_ring *ring = rt_ring_open ("/dev/shm/wallboard");
+ *
+ *     if (ring)
+ *         rt_ring_write (ring, "build 1234 passed", 17);
+ *
+ * rt_ring_write () never blocks: when the ring is full the line is
+ * dropped (and counted in root-tail's statistics).  Lines longer than
+ * RT_RING_LINE_MAX bytes are cut short.  If root-tail is restarted,
+ * the producers have to rt_ring_open () the ring again.  Only
+ * processes of the user running root-tail can attach.
+ *
+ * The ring is a bounded multi-producer queue after Dmitry Vyukov: every
+ * slot has a sequence number telling producers and the consumer whose
+ * turn it is, so producers only contend on a single compare-and-swap.
+ * root-tail sleeps in its event loop; a producer that finds it asleep
+ * wakes it through an eventfd it was handed by root-tail when it
+ * attached.
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ */
+
+#ifndef RTRING_H
+#define RTRING_H
+
+#include <stddef.h>
+
+#define RT_RING_MAGIC    0x72747231UL /* "rtr1" */
+#define RT_RING_SLOTS    1024         /* must be a power of two         */
+#define RT_RING_LINE_MAX 500          /* makes a slot 512 bytes on LP64 */
+
+struct rt_ring_slot {
+    unsigned long seq; /* pos: free for pos, pos + 1: holds line pos   */
+    unsigned int len;
+    char line[RT_RING_LINE_MAX];
+};
+
+/* the shared memory; the positions get a cache line each so producers
+ * and the consumer don't keep stealing it from each other */
+struct rt_ring_shared {
+    unsigned long magic;
+    unsigned long slots;
+    char pad0[64 - 2 * sizeof(unsigned long)];
+    unsigned long enqueue_pos; /* next slot a producer claims            */
+    char pad1[64 - sizeof(unsigned long)];
+    unsigned long dequeue_pos; /* next slot root-tail reads              */
+    int waiting;               /* true if root-tail wants a wakeup       */
+    unsigned long dropped;     /* lines lost because the ring was full   */
+    char pad2[64 - 3 * sizeof(unsigned long)];
+    struct rt_ring_slot slot[RT_RING_SLOTS];
+};
+
+struct rt_ring {
+    struct rt_ring_shared *shared;
+    int event_fd;  /* eventfd waking root-tail                          */
+    int listen_fd; /* root-tail only: where producers come to attach    */
+    char *path;    /* root-tail only: the file, to remove on exit       */
+};
+
+/* for producers */
+struct rt_ring *rt_ring_open(const char *path);
+int rt_ring_write(struct rt_ring *ring, const char *line, size_t len);
+void rt_ring_close(struct rt_ring *ring);
+
+/* for root-tail */
+struct rt_ring *rt_ring_create(const char *path);
+void rt_ring_unlink(struct rt_ring *ring);
+void rt_ring_accept(struct rt_ring *ring);
+const char *rt_ring_peek(struct rt_ring *ring, unsigned int *len);
+void rt_ring_release(struct rt_ring *ring);
+
+#endif